@@ -26,7 +26,14 @@ SOURCES+=$$PWD/src/main.cpp\
          $$PWD/src/view.cpp \
          $$PWD/src/grid.cpp \
          $$PWD/src/cell.cpp \
-         $$PWD/src/particle.cpp
+         $$PWD/src/particle.cpp \
+         $$PWD/src/particlepool.cpp \
+         $$PWD/src/pressureoperator.cpp \
+         $$PWD/src/pressuremultigrid.cpp \
+         $$PWD/src/pressuresolver.cpp \
+         $$PWD/src/particleintegrator.cpp \
+         $$PWD/src/substepscheduler.cpp \
+         $$PWD/src/simulationworker.cpp
 
 HEADERS+=$$PWD/include/mainwindow.h \
          $$PWD/include/fluidsimulator.h \
@@ -34,7 +41,17 @@ HEADERS+=$$PWD/include/mainwindow.h \
          $$PWD/include/windowparams.h \
          $$PWD/include/grid.h \
          $$PWD/include/cell.h \
-         $$PWD/include/particle.h
+         $$PWD/include/particle.h \
+         $$PWD/include/particlepool.h \
+         $$PWD/include/parallel.h \
+         $$PWD/include/pressureoperator.h \
+         $$PWD/include/pressuremultigrid.h \
+         $$PWD/include/pressuresolver.h \
+         $$PWD/include/ringbuffer.h \
+         $$PWD/include/particleintegrator.h \
+         $$PWD/include/substepscheduler.h \
+         $$PWD/include/triplebuffer.h \
+         $$PWD/include/simulationworker.h
 
 INCLUDEPATH+=./include
 
@@ -2,18 +2,19 @@
 #define CELL_H
 
 #include <ngl/Vec2.h>
-#include <vector>
-#include <map>
+#include <array>
 #include <cassert>
 
 #include "particle.h"
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @enum used to describe what a cell contains
-enum class Label{ EMPTY, SOLID, FLUID };
+enum class Label : unsigned char { EMPTY, SOLID, FLUID };
 //----------------------------------------------------------------------------------------------------------------------
 /// @enum used to describe the status of a cell
-enum class Status{ ACTIVE, INACTIVE };
+enum class Status : unsigned char { ACTIVE, INACTIVE };
+
+class Grid;
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @class Cell
@@ -22,60 +23,62 @@ enum class Status{ ACTIVE, INACTIVE };
 /// and the particles. It is used to implement a MAC-Grid, for this reason the velocities are stored at the edges and the
 /// pressure in the centre of the cell.
 ///
+/// The cell is a lightweight view over the grid: it only stores the grid it belongs to and its index.
+/// Labels, velocities, pressure and particle counts live in the grid arrays, while bounds, half edges and neighbours
+/// are computed from the index.
 ///  @author Federico Leone
-///  @version 2.0
+///  @version 3.0
 ///  @date
 //----------------------------------------------------------------------------------------------------------------------
 
 class Cell
 {
-    typedef float* magnitude_ptr;
-    typedef Cell* cell_ptr;
-    typedef Particle* particle_ptr;
     typedef ngl::Vec2 vec2;
 
 public:
     Cell();
-    Cell(const size_t _index, const vec2 _minUV, const vec2 _maxUV, const std::array<magnitude_ptr,7>& _magnitude,const std::array<cell_ptr,4>& _neighbours);
+    Cell(Grid* _grid, const size_t _index);
     Cell(const Cell& _other);
     Cell& operator=(const Cell& _other);
-    virtual ~Cell();
+    ~Cell();
 
     //get methods
-    Label label() const             {return m_label;}
-    Status status() const           {return m_status;}
+    Label label() const;
+    Status status() const;
     size_t index() const             {return m_index;}
+    size_t column() const;
+    size_t row() const;
 
-    float deltaU() const            {return m_deltaU;}
-    float deltaV() const            {return m_deltaV;}
+    float deltaU() const;
+    float deltaV() const;
 
-    float minU() const            {return m_minU;}
-    float minV() const            {return m_minV;}
-    float maxU() const            {return m_maxU;}
-    float maxV() const            {return m_maxV;}
+    float minU() const;
+    float minV() const;
+    float maxU() const;
+    float maxV() const;
 
-    vec2 centre() const           {return m_centre;}
+    vec2 centre() const;
 
-    vec2 halfEdge(char _key)    {return m_halfEdge[_key];}
+    vec2 halfEdge(char _key) const;
 
-    size_t particleCount() const {return m_particleCount;}
-    std::vector<int> neighbours() {return m_neighbourIndexList;}
+    size_t particleCount() const;
+    std::array<int,4> neighbours() const;
 
-    float density();
+    float density() const;
 
-    float velocityU();
-    float velocityV();
-    float deltaVelocityU();
-    float deltaVelocityV();
-    float initialVelocityU();
-    float initialVelocityV();
+    float velocityU() const;
+    float velocityV() const;
+    float deltaVelocityU() const;
+    float deltaVelocityV() const;
+    float initialVelocityU() const;
+    float initialVelocityV() const;
 
-    vec2 velocity(const vec2 _point);
-    vec2 deltaVelocity(const vec2 _point);
+    vec2 velocity(const vec2 _point) const;
+    vec2 deltaVelocity(const vec2 _point) const;
 
-    float divergence();
+    float divergence() const;
 
-    float pressure();
+    float pressure() const;
 
 
     //set methods
@@ -89,45 +92,11 @@ public:
 
     void setPressure(const float _magnitude);
 
-    void resetParticleCount() {m_particleCount = 0;}
-    void incrementParticleCount() {++m_particleCount;}
-    void setParticlePoolSize(size_t _size) {m_particlePoolSize = _size;}
-
-    void initNeighbourIndexList();
-
 private:
-    Label m_label;
-    Status m_status;
-    size_t m_index;
-
-    float m_deltaU;
-    float m_deltaV;
-
-    float m_minU;
-    float m_minV;
-    float m_maxU;
-    float m_maxV;
-
-    vec2 m_centre;
+    int neighbour(char _key) const;
 
-    std::map<char,vec2> m_halfEdge;
-
-    size_t m_particlePoolSize; //used in density
-    size_t m_particleCount;
-
-    magnitude_ptr m_initialVelocityU;
-    magnitude_ptr m_velocityU;
-    magnitude_ptr m_deltaVelocityU;
-
-    magnitude_ptr m_initialVelocityV;
-    magnitude_ptr m_velocityV;
-    magnitude_ptr m_deltaVelocityV;
-
-    magnitude_ptr m_pressure;
-
-    std::map<char,cell_ptr> m_neighbour;
-    std::vector<int> m_neighbourIndexList;
-    std::vector<particle_ptr> m_particles;
+    Grid* m_grid;
+    size_t m_index;
 };
 
 #endif // CELL_H
@@ -5,6 +5,12 @@
 #include <queue>
 
 #include "grid.h"
+#include "parallel.h"
+#include "particleintegrator.h"
+#include "pressureoperator.h"
+#include "pressuresolver.h"
+#include "ringbuffer.h"
+#include "substepscheduler.h"
 
 #include <eigen3/Eigen/Dense>
 #include <eigen3/Eigen/Sparse>
@@ -16,10 +22,38 @@ using Eigen::Triplet;
 using Eigen::RowMajor;
 using Eigen::ConjugateGradient;
 using Eigen::Success;
+using Eigen::Lower;
+using Eigen::Upper;
 typedef Triplet<double> Tripletd;
 
 
+//----------------------------------------------------------------------------------------------------------------------
+/// @enum schemes used by advectVelocity
+enum class VelocityAdvection{ SEMI_LAGRANGIAN, MACCORMACK };
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @struct FrameBudgetReport
+/// @brief Outcome of a frame run with a wall-clock budget, in milliseconds, and the quality knobs it used to keep
+/// within it: a larger CFL number, a looser pressure tolerance, fewer substeps than the CFL condition asks, and no
+/// new visualisation data for the frame.
+//----------------------------------------------------------------------------------------------------------------------
+struct FrameBudgetReport
+{
+    double m_budget = 0.0;
+    double m_time = 0.0;
+    size_t m_substeps = 0;
+    bool m_overrun = false;
+    bool m_largerCFL = false;
+    bool m_looserPressure = false;
+    bool m_cappedSubsteps = false;
+    bool m_skipVisualisation = false;
+};
+
 typedef void (*FrameReadyHandler)(bool _newFrame);
+typedef void (*PressureSolveHandler)(const PressureSolveRecord& _record);
+
+/// @brief PressureSolveHandler writing the record of a solve on std::cout
+void printPressureSolve(const PressureSolveRecord& _record);
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @class FluidSimulator
@@ -38,7 +72,6 @@ class FluidSimulator
 {
     typedef ngl::Vec3 vec3;
     typedef ngl::Vec2 vec2;
-    typedef Particle* particle_ptr;
     typedef Cell* cell_ptr;
 
 public:
@@ -54,21 +87,108 @@ public:
 
     void setPressureSolverMode(bool _mode)           {m_pressureSolverMode = _mode;}
 
+    /// @brief algorithm used to solve the pressure, and preconditioner used by the conjugate gradient
+    PressureSolverType pressureSolverType() const                {return m_pressureSolverType;}
+    void setPressureSolverType(PressureSolverType _type);
+    PressurePreconditioner pressurePreconditioner() const        {return m_pressurePreconditioner;}
+    void setPressurePreconditioner(PressurePreconditioner _mode);
+
+    /// @brief the current pressure solver, to read the stats of the last solve. A new solver is created when the type or
+    /// the preconditioner change, so only the settings kept here carry over
+    PressureSolver& pressureSolver();
+
+    /// @brief relative residual the pressure solve has to reach, whatever the solver. It is clamped to the
+    /// minTolerance() of the solvers that can not reach it
+    double pressureTolerance() const                 {return m_pressureTolerance;}
+    void setPressureTolerance(double _tolerance);
+
+    /// @brief fraction of the cells that may change label in a substep before the pressure operator and the solver are
+    /// rebuilt instead of patched, for both
+    double pressureRebuildFraction() const           {return m_pressureRebuildFraction;}
+    void setPressureRebuildFraction(double _fraction);
+
+    /// @brief seeds the conjugate gradient with the pressure of the previous substep instead of zero
+    bool pressureWarmStart() const                   {return m_pressureWarmStart;}
+    void setPressureWarmStart(bool _mode)            {m_pressureWarmStart = _mode;}
+
+    /// @brief iterations of the last pressure solve and the estimated iterations saved by the warm start
+    size_t pressureIterations() const                {return m_pressureRecord.m_stats.m_iterations;}
+    long pressureIterationsSaved() const             {return m_pressureRecord.m_iterationsSaved;}
+
+    /// @brief records of the last pressure solves, one per substep, oldest first. A capacity of 0 stops the recording
+    const RingBuffer<PressureSolveRecord>& pressureHistory() const   {return m_pressureHistory;}
+    void setPressureHistoryCapacity(size_t _capacity)                {m_pressureHistory.setCapacity(_capacity);}
+
+    /// @brief optional sink called with the record of every pressure solve, e.g. printPressureSolve. nullptr disables it
+    void setPressureSolveHandler(PressureSolveHandler _handler)      {m_pressureSolveHandler = _handler;}
+
+    /// @brief number of threads used by the parallel parts of the routine. 1 runs everything serially
+    size_t threadCount() const                       {return m_threadCount;}
+    void setThreadCount(size_t _count)               {m_threadCount = _count>0 ? _count : 1;}
+
+    /// @brief statistics of the grid velocity of the last substep, after the pressure solve
+    const GridVelocityStats& velocityStats() const   {return m_grid.velocityStats();}
+
+    /// @brief CFL number, cells travelled by the fastest grid velocity in a substep, which sets the substep length
+    float cfl() const                                {return m_substepScheduler.cfl();}
+    void setCFL(float _cfl)                          {m_substepScheduler.setCFL(_cfl);}
+
+    /// @brief substep scheduling of advanceFrame: substep budget per frame, growth limit and history of the frames
+    SubstepScheduler& substepScheduler()             {return m_substepScheduler;}
+    const RingBuffer<SubstepFrameRecord>& substepHistory() const {return m_substepScheduler.history();}
+
+    /// @brief integrator moving the particles. The Runge-Kutta ones sample the grid velocity and stay stable at larger
+    /// CFL numbers, see measureStableCFL
+    ParticleIntegrator particleIntegrator() const    {return m_particleIntegrator;}
+    void setParticleIntegrator(ParticleIntegrator _integrator)   {m_particleIntegrator = _integrator;}
+
+    /// @brief largest CFL number the integrator keeps stable, in cells per substep as setCFL
+    float measureStableCFL(ParticleIntegrator _integrator) const {return ::measureStableCFL(_integrator);}
+
+    /// @brief scheme of advectVelocity. MacCormack corrects the semi-Lagrangian step with a trace back in time and keeps
+    /// much more detail, for about twice the cost
+    VelocityAdvection velocityAdvection() const      {return m_velocityAdvection;}
+    void setVelocityAdvection(VelocityAdvection _mode)   {m_velocityAdvection = _mode;}
+
+    /// @brief minimum number of particles given to each thread by the particle transfer and advection
+    size_t particleGrainSize() const                 {return m_particleGrainSize;}
+    void setParticleGrainSize(size_t _size)          {m_particleGrainSize = _size>0 ? _size : 1;}
+
+    /// @brief minimum number of cells given to each thread by the grid passes
+    size_t cellGrainSize() const                     {return m_cellGrainSize;}
+    void setCellGrainSize(size_t _size)              {m_cellGrainSize = _size>0 ? _size : 1;}
+
     std::vector<vec3> velocityField(float _time);
     std::vector<vec3> activeCells(float _time);
     std::vector<vec3> boundaries();
 
-    void boundaryCollide(particle_ptr _p);
+    void boundaryCollide(float _x, float _y, float& _vx, float& _vy) const;
 
     std::vector<vec3> particles();
 
+    /// @brief advances a frame at full quality, i.e. advanceFrame(double) with an unlimited budget
     void advanceFrame();
+
+    /// @brief advances a frame within _budget milliseconds of wall-clock time. Whenever the substeps left, at the cost
+    /// of the substeps already run, would overrun the budget the next knob is used, in order: the CFL number is scaled
+    /// by budgetCFLScale(), the pressure tolerance is loosened to budgetPressureTolerance(), and the substeps left are
+    /// capped to what the budget can still pay. While _playing, a frame that capped its substeps or overran asks the
+    /// View to skip the visualisation data, the next frame follows soon. A frame run on its own always asks for its
+    /// data. The knobs only last for the frame
+    FrameBudgetReport advanceFrame(double _budget, bool _playing = true);
+    float budgetCFLScale() const                     {return m_budgetCFLScale;}
+    void setBudgetCFLScale(float _scale)             {m_budgetCFLScale = _scale;}
+    double budgetPressureTolerance() const           {return m_budgetPressureTolerance;}
+    void setBudgetPressureTolerance(double _tolerance)   {m_budgetPressureTolerance = _tolerance;}
     void routineFLIP(float _timeStep);
     void transferToGrid();
+    void transferToGridParallel(float _weight);
     void advectParticles(float _timeStep);
+    void advectParticles(float _timeStep, size_t _begin, size_t _end, size_t* _cellCount);
     void markCells();
     vec2 particleTrace(vec2 _pos, float _timeStep);
     void advectVelocity(float _timeStep);
+    void semiLagrangianAdvection(float _timeStep, float* _u, float* _v);
     VectorXd negativeDivergence(float _timeStep);
     SparseMatrix<double,RowMajor> setUpMatrixA(float _timeStep);
     void updatePressureField(VectorXd _p);
@@ -78,6 +198,8 @@ public:
 
 protected:
     void setFrameReady(const bool _frameReady);
+
+    VectorXd pressureGuess(const VectorXd& _b);
 //    void registerFrameReadyHandler(FrameReadyHandler _handler);
 
     void initCellCentres();
@@ -85,6 +207,8 @@ protected:
     void emitParticlesPerCell(size_t _count, size_t _seed = 0, float _velocity = 0.0f);
     void emitParticles(size_t _count,size_t _seed = 0,float _velocity=0.0f);
 
+    void scatterCells(size_t _begin, size_t _end, float _weight, float* _u, float* _v);
+
     float kernel(vec2 _xp);
     float h(float _r);
 
@@ -92,16 +216,61 @@ protected:
     float vsolid(size_t _x, size_t _y);
 
 private:
+    void resetPressureSolver();
 
-    bool m_frameReady = false;
     bool m_pressureSolverMode = false;
-    float m_cfl = 2.0;
+    PressureSolverType m_pressureSolverType = PressureSolverType::CONJUGATE_GRADIENT;
+    PressurePreconditioner m_pressurePreconditioner = PressurePreconditioner::DIAGONAL;
+    double m_pressureTolerance = Eigen::NumTraits<double>::epsilon();
+    double m_pressureRebuildFraction = 0.1;
+    bool m_pressureWarmStart = false;
+    size_t m_substep = 0;
+
+    //telemetry of the pressure solves, the last one is kept even when the history is disabled
+    PressureSolveRecord m_pressureRecord;
+    RingBuffer<PressureSolveRecord> m_pressureHistory = RingBuffer<PressureSolveRecord>(256);
+    PressureSolveHandler m_pressureSolveHandler = nullptr;
+    SubstepScheduler m_substepScheduler;
+    float m_budgetCFLScale = 2.0f;
+    double m_budgetPressureTolerance = 1e-4;
+    ParticleIntegrator m_particleIntegrator = ParticleIntegrator::FORWARD_EULER;
+    VelocityAdvection m_velocityAdvection = VelocityAdvection::SEMI_LAGRANGIAN;
+    size_t m_threadCount = 1;
+    size_t m_particleGrainSize = 4096;
+    size_t m_cellGrainSize = 4096;
 
 
     Grid m_grid;
     std::vector<vec3> m_cellCentres;
-    std::vector<Particle> m_particlePool;
+    ParticlePool m_particlePool;
     size_t m_simulationSize;
+
+    //matrix-free pressure matrix and the solver used by pressureSolve. The solver is created on first use
+    PressureOperator m_pressureOperator;
+    std::unique_ptr<PressureSolver> m_pressureSolver;
+
+    //labels at the last markCells, and cells whose label changed since the last pressure solve. When too many cells
+    //changed, or the grid changed size, the operator and the solver are rebuilt instead of patched
+    std::vector<Label> m_cellLabel;
+    std::vector<size_t> m_changedCells;
+    bool m_pressureRebuild = true;
+
+    //labels and operator scale of the last pressure solve, used to remap the warm start
+    std::vector<Label> m_pressureLabel;
+    double m_pressureScale = 0.0;
+
+    //per thread accumulation buffers used by transferToGridParallel
+    std::vector<std::vector<float>> m_transferBufferU;
+    std::vector<std::vector<float>> m_transferBufferV;
+
+    //velocity advected by the semi-Lagrangian step of the MacCormack scheme
+    std::vector<float> m_advectedVelocityU;
+    std::vector<float> m_advectedVelocityV;
+
+    //per thread particle counts of the cells used by advectParticles, and whether the particles still have the cell
+    //index it found, so markCells can skip straight to the sort
+    std::vector<std::vector<size_t>> m_particleCountBuffer;
+    bool m_particlesIndexed = false;
 };
 
 #endif // FLUIDSIMULATOR_H
@@ -2,7 +2,24 @@
 #define GRID_H
 
 #include <ngl/Vec2.h>
+#include <vector>
 #include "cell.h"
+#include "particlepool.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @struct GridVelocityStats
+/// @brief Summary of the grid velocity found by Grid::velocityUpdate(): the largest speed of a cell, the kinetic
+/// energy 0.5*sum(u*u+v*v)*dx*dy of the faces, per unit density, and the L2 and max norms of the divergence of the
+/// FLUID cells, as Cell::divergence().
+//----------------------------------------------------------------------------------------------------------------------
+struct GridVelocityStats
+{
+    float m_maxVelocity = 0.0f;
+    double m_kineticEnergy = 0.0;
+    double m_divergenceL2 = 0.0;
+    float m_divergenceMax = 0.0f;
+    size_t m_fluidCells = 0;
+};
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @class Grid
@@ -10,7 +27,7 @@
 /// It provides the methods to set and access information in the simulation space.
 /// It provides a useful interface to write algorithms that should run on specific cells as well as on the whole set of cells.
 /// The grid also implements methods to easily perform operations on the velocity components without accessing the cells.
-/// DeltaVelocityUpdate() , for example, computes the delta between the initial velocity, as retreived from the particles,
+/// velocityUpdate(), for example, computes the delta between the initial velocity, as retreived from the particles,
 /// and the velocity edited by the main routine, without accessing any cell.
 ///  @author Federico Leone
 ///  @version 2.0
@@ -18,12 +35,14 @@
 //----------------------------------------------------------------------------------------------------------------------
 class Grid
 {
-    typedef float* magnitude_ptr;
+    friend class Cell;
+
     typedef Cell* cell_ptr;
     typedef ngl::Vec2 vec2;
 
 private:
     void initGrids();
+    void sampleCell(float _x, float _y, size_t& _column, size_t& _row, float& _alphaU, float& _alphaV) const;
 
 public:
     Grid();
@@ -41,7 +60,11 @@ public:
     float height() const                 {return m_height;}
     float deltaU() const                 {return m_deltaU;}
     float deltaV() const                 {return m_deltaV;}
-    float maxVelocity() const            {return m_maxVelocity;}
+    float maxVelocity() const            {return m_velocityStats.m_maxVelocity;}
+    const GridVelocityStats& velocityStats() const   {return m_velocityStats;}
+    size_t particlePoolSize() const      {return m_particlePoolSize;}
+
+    void setParticlePoolSize(size_t _size)   {m_particlePoolSize = _size;}
 
 
     size_t toIndex(const size_t _x,const size_t _y);
@@ -53,6 +76,15 @@ public:
     vec2 deltaVelocity(const vec2 _point);
     vec2 deltaVelocity(const size_t _x,const size_t _y);
 
+    //samples face values stored as the velocity, e.g. the back buffers, and gives the range of the face values it
+    //interpolated. Points outside the grid give a zero value and range
+    void sampleFaces(const float* _faceU, const float* _faceV, float _x, float _y, float& _u, float& _v) const;
+    void faceRange(const float* _faceU, const float* _faceV, float _x, float _y, vec2& _min, vec2& _max) const;
+
+    //batched sampling, the points are given as separate x and y arrays of _count elements
+    void sampleVelocity(const float* _x, const float* _y, float* _u, float* _v, size_t _count) const;
+    void sampleDeltaVelocity(const float* _x, const float* _y, float* _u, float* _v, size_t _count) const;
+
     float velocityDivergence(const vec2 _point);
     float velocityDivergence(const size_t _x,const size_t _y);
 
@@ -62,6 +94,8 @@ public:
     float pressure(const vec2 _point);
     void pressure(const size_t _x,const float _pressure);
 
+    Label label(const size_t _index) const   {return m_gridLabel[_index];}
+
     Cell& cell(const size_t _index);
     Cell& cell(const vec2 _point);
     Cell& cell(const size_t _x,const size_t _y);
@@ -83,11 +117,37 @@ public:
     const_iterator cbegin() const {return m_gridCell.cbegin();}
     const_iterator cend() const {return m_gridCell.cend();}
 
+    //direct access to the initial velocity values, indexed as the cells
+    float* initialVelocityU()            {return m_gridInitialVelocityU.data();}
+    float* initialVelocityV()            {return m_gridInitialVelocityV.data();}
+
+    const float* velocityU() const       {return m_gridVelocityU.data();}
+    const float* velocityV() const       {return m_gridVelocityV.data();}
+
+    //back buffers of the velocity, indexed as the cells. A pass can write the new velocity there while it still reads
+    //the current one, then swapVelocity() makes it current in O(1)
+    float* backVelocityU()               {return m_gridBackVelocityU.data();}
+    float* backVelocityV()               {return m_gridBackVelocityV.data();}
+    void swapVelocity();
+
+    //particles sorted per cell. sortParticles() finds the cell of every particle and sorts the pool. A pass already
+    //walking the particles can instead store their cell index and fill particleCounts(), then call
+    //sortIndexedParticles() to only run the sort
+    size_t cellIndex(const vec2 _point) const;
+    void sortParticles(ParticlePool& _particles);
+    void sortIndexedParticles(ParticlePool& _particles);
+    size_t* particleCounts()                            {return m_particleCount.data();}
+    const size_t* particleOffsets() const               {return m_particleOffset.data();}
+    size_t particleOffset(const size_t _index) const   {return m_particleOffset[_index];}
+    size_t particleCount(const size_t _index) const    {return m_particleCount[_index];}
+
     //reset
     void resetInitialVelocity();
+    void applyInitialVelocity();
 
-    void maxVelocityUpdate();
-    void deltaVelocityUpdate();
+    //single pass over the velocity arrays: stores the delta velocity, updated minus initial, and the velocityStats().
+    //The cells are split in _nChunks contiguous chunks run in parallel, reduced in chunk order
+    void velocityUpdate(size_t _nChunks = 1);
 
 private:
 
@@ -105,19 +165,35 @@ private:
     std::vector<vec2> m_cellCentres;
 
 
-    float m_maxVelocity;
+    GridVelocityStats m_velocityStats;
+    std::vector<GridVelocityStats> m_chunkVelocityStats;
 
     //three vectors for each velocity direction
     std::vector<float> m_gridInitialVelocityU; //stores the values that come from the particles
     std::vector<float> m_gridVelocityU; //stores the new values, updated after pressure calculation
     std::vector<float> m_gridDeltaVelocityU; //delta value to add to particles velocity
+    std::vector<float> m_gridBackVelocityU; //next values of m_gridVelocityU, see swapVelocity()
 
     std::vector<float> m_gridInitialVelocityV;
     std::vector<float> m_gridVelocityV;
     std::vector<float> m_gridDeltaVelocityV;
+    std::vector<float> m_gridBackVelocityV;
 
     std::vector<float> m_gridPressure;
+
+    std::vector<Label> m_gridLabel;
+    std::vector<Status> m_gridStatus;
+    size_t m_particlePoolSize = 0; //used in density
+
+    //the cells are views over the arrays above
     std::vector<Cell> m_gridCell;
+
+    //counting sort of the particles. The particles of cell i are stored in
+    //[m_particleOffset[i], m_particleOffset[i]+m_particleCount[i]) after sortParticles()
+    std::vector<size_t> m_particleOffset;
+    std::vector<size_t> m_particleCount;
+    std::vector<uint32_t> m_sortDestination;
+    ParticlePool m_sortedParticles;
 };
 
 #endif // GRID_H
@@ -3,13 +3,15 @@
 
 #include <QMainWindow>
 #include "fluidsimulator.h"
+#include "simulationworker.h"
 #include "view.h"
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @class MainWindow
 /// @brief The MainWindow class is the Control component in the MVC design pattern.
 /// The class connects the GUI with the simulation model and the display(view) class.
-/// It also controls the simulation execution and the visualised data.
+/// It also controls the simulation execution and the visualised data: the play and frame controls are sent as
+/// commands to the SimulationWorker running the simulation thread.
 ///
 /// Originally based on class MainWindow from https://github.com/NCCA/QtNGL.git
 ///  @author Federico Leone
@@ -41,10 +43,12 @@ public:
 
     void setFluidSimulator(FluidSimulator* _fluidsimulator);
     void setViewer(View* _view);
+    void setSimulationWorker(SimulationWorker* _simulationWorker);
 
 private:
     Ui::MainWindow *m_ui;
     FluidSimulator *m_fluidsimulator;
+    SimulationWorker *m_simulationWorker;
     View *m_view;
 
 };
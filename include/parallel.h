@@ -0,0 +1,204 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file parallel.h
+/// @brief Minimal helpers to split the simulation loops across threads.
+/// The range [0,_count) is split in contiguous chunks, one per thread. Chunk boundaries depend only on _count and
+/// _nThreads, so a loop that writes disjoint data per chunk gives the same result as its serial version.
+/// The chunks run on a pool of threads started on first use, see ParallelPool.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief returns the number of chunks actually used to split _count items across _nThreads threads
+//----------------------------------------------------------------------------------------------------------------------
+inline size_t parallelChunks(size_t _count, size_t _nThreads)
+{
+    return std::max<size_t>(1,std::min(_count,_nThreads));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class ParallelPool
+/// @brief Worker threads started once and reused by every parallelFor, so that a loop does not pay the creation of its
+/// threads. Worker k always runs chunk k, and a run of n chunks has n-1 workers to itself, so the chunks of a run are
+/// all running at the same time and can wait on a ParallelBarrier. The pool grows when a run needs more workers.
+/// The pool runs one loop at a time: run() returns false without running anything when it is already busy, e.g. for a
+/// parallelFor nested in another one or called by a second thread.
+//----------------------------------------------------------------------------------------------------------------------
+class ParallelPool
+{
+public:
+    static ParallelPool& instance()
+    {
+        static ParallelPool pool;
+        return pool;
+    }
+
+    ~ParallelPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_start.notify_all();
+        for(auto &worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    //runs _task(chunk) for every chunk of [0,_nChunks), the first one on the calling thread, and waits for all of them
+    bool run(size_t _nChunks, const std::function<void(size_t)>& _task)
+    {
+        std::unique_lock<std::mutex> dispatch(m_dispatch,std::try_to_lock);
+        if(!dispatch.owns_lock())
+            return false;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            while(m_workers.size()+1 < _nChunks)
+            {
+                m_workers.emplace_back(&ParallelPool::work,this,m_workers.size()+1,m_generation);
+            }
+            m_task = &_task;
+            m_nChunks = _nChunks;
+            m_pending = _nChunks-1;
+            ++m_generation;
+        }
+        m_start.notify_all();
+
+        _task(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock,[this]{return m_pending == 0;});
+        m_task = nullptr;
+        return true;
+    }
+
+private:
+    ParallelPool() {}
+    ParallelPool(const ParallelPool&) = delete;
+    ParallelPool& operator=(const ParallelPool&) = delete;
+
+    //loop of worker _chunk, which sleeps until a run needs its chunk
+    void work(size_t _chunk, size_t _generation)
+    {
+        while(true)
+        {
+            const std::function<void(size_t)>* task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start.wait(lock,[this,_generation]{return m_quit || m_generation != _generation;});
+                if(m_quit)
+                    return;
+
+                _generation = m_generation;
+                if(_chunk >= m_nChunks)
+                    continue;
+                task = m_task;
+            }
+
+            (*task)(_chunk);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(--m_pending == 0)
+                m_done.notify_one();
+        }
+    }
+
+    std::mutex m_dispatch;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    std::vector<std::thread> m_workers;
+
+    //current run, guarded by m_mutex
+    const std::function<void(size_t)>* m_task = nullptr;
+    size_t m_nChunks = 0;
+    size_t m_pending = 0;
+    size_t m_generation = 0;
+    bool m_quit = false;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief runs _function(begin,end,chunk) on every chunk of [0,_count).
+/// The calling thread runs the first chunk, the others run on the workers of the ParallelPool. When the pool is busy
+/// the chunks run on threads created for the call, joined before returning.
+//----------------------------------------------------------------------------------------------------------------------
+template<typename Function>
+void parallelFor(size_t _count, size_t _nThreads, Function _function)
+{
+    size_t nChunks = parallelChunks(_count,_nThreads);
+    size_t chunkSize = (_count+nChunks-1)/nChunks;
+    if(nChunks == 1)
+    {
+        _function(0,_count,0);
+        return;
+    }
+
+    std::function<void(size_t)> task = [&_function,_count,chunkSize](size_t _chunk)
+    {
+        size_t begin = std::min(_count,_chunk*chunkSize);
+        size_t end = std::min(_count,begin+chunkSize);
+        _function(begin,end,_chunk);
+    };
+    if(ParallelPool::instance().run(nChunks,task))
+        return;
+
+    std::vector<std::thread> workers;
+    for(size_t chunk = 1; chunk<nChunks; ++chunk)
+    {
+        workers.emplace_back(task,chunk);
+    }
+
+    task(0);
+
+    for(auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class ParallelBarrier
+/// @brief Blocks the threads of a parallelFor until all _count of them have called wait(), so that a loop can run
+/// several dependent phases without respawning the threads between them.
+//----------------------------------------------------------------------------------------------------------------------
+class ParallelBarrier
+{
+public:
+    explicit ParallelBarrier(size_t _count) : m_count(_count), m_waiting(0), m_generation(0) {}
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        size_t generation = m_generation;
+        if(++m_waiting == m_count)
+        {
+            m_waiting = 0;
+            ++m_generation;
+            m_condition.notify_all();
+            return;
+        }
+        m_condition.wait(lock,[this,generation]{return generation != m_generation;});
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    size_t m_count;
+    size_t m_waiting;
+    size_t m_generation;
+};
+
+#endif // PARALLEL_H
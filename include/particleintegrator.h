@@ -0,0 +1,43 @@
+#ifndef PARTICLEINTEGRATOR_H
+#define PARTICLEINTEGRATOR_H
+
+#include <cstddef>
+
+#include "grid.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file particleintegrator.h
+/// @brief Time integrators moving the particles through the grid velocity field.
+/// Forward Euler moves the particle along its own velocity and is only stable for small substeps. The Runge-Kutta
+/// integrators sample the grid velocity at intermediate positions: midpoint RK2 and Ralston RK3, the third order
+/// scheme suggested by (Bridson,2011), which follows rotations much longer before drifting and so allows larger CFL
+/// substeps for the same error.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @enum integrators available to advect the particles
+enum class ParticleIntegrator{ FORWARD_EULER, MIDPOINT_RK2, RALSTON_RK3 };
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief moves the _count points (_x,_y) by _timeStep through the velocity of _grid with the given integrator.
+/// FORWARD_EULER samples the grid velocity at the point, FluidSimulator uses the particle velocity instead
+//----------------------------------------------------------------------------------------------------------------------
+void integrateParticles(ParticleIntegrator _integrator, const Grid& _grid, float _timeStep,
+                        float* _x, float* _y, size_t _count);
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief measures the largest CFL number, in cells travelled per substep, the integrator can use without blowing up.
+/// Points on a ring of _radius cells are carried for _revolutions revolutions by a solid body rotation sampled on a
+/// grid, with increasing CFL numbers. The exact motion keeps an invariant of the sampled field, close to the squared
+/// radius, so a CFL number is stable while the invariant of every point grows by at most _growth. This is a stability
+/// limit, not an accuracy one: a stable step can still drift. For a rotation the limit is an angle per substep, so it
+/// scales with _radius. With the defaults it is about 0.2 cells for forward Euler and 3 for RK2, which spiral out at
+/// any step size, and 15 for RK3, which stays bounded up to about two radians per substep.
+//----------------------------------------------------------------------------------------------------------------------
+float measureStableCFL(ParticleIntegrator _integrator, size_t _radius = 8, float _growth = 2.0f,
+                       size_t _revolutions = 4);
+
+#endif // PARTICLEINTEGRATOR_H
@@ -0,0 +1,188 @@
+#ifndef PARTICLEPOOL_H
+#define PARTICLEPOOL_H
+
+#include <ngl/Vec2.h>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <iterator>
+
+#include "particle.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class AlignedAllocator
+/// @brief Allocator returning memory aligned to _Alignment bytes, so that the particle arrays start on a SIMD boundary.
+//----------------------------------------------------------------------------------------------------------------------
+template<typename T, size_t Alignment = 32>
+class AlignedAllocator
+{
+public:
+    typedef T value_type;
+    template<typename U> struct rebind { typedef AlignedAllocator<U,Alignment> other; };
+
+    AlignedAllocator() {}
+    template<typename U> AlignedAllocator(const AlignedAllocator<U,Alignment>&) {}
+
+    T* allocate(size_t _n)
+    {
+        //over-allocates and stores the original pointer just before the aligned block
+        void* raw = ::operator new(_n*sizeof(T) + Alignment + sizeof(void*));
+        uintptr_t start = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+        uintptr_t aligned = (start + Alignment - 1) & ~static_cast<uintptr_t>(Alignment - 1);
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* _p, size_t)
+    {
+        ::operator delete(reinterpret_cast<void**>(_p)[-1]);
+    }
+
+    template<typename U> bool operator==(const AlignedAllocator<U,Alignment>&) const {return true;}
+    template<typename U> bool operator!=(const AlignedAllocator<U,Alignment>&) const {return false;}
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class ParticlePool
+/// @brief Structure of arrays storage for the particles of the FLIP routine.
+/// Positions, velocities and cell indices are stored in separate aligned arrays, so that the loops over the particles
+/// walk contiguous memory and can be vectorised. The proxies reference and Vec2Ref let the pool be used as a
+/// container of Particle, e.g. p.m_position.m_x or p.m_velocity += v, when performance is not a concern.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+class ParticlePool
+{
+    typedef ngl::Vec2 vec2;
+
+public:
+    typedef std::vector<float,AlignedAllocator<float>> float_array;
+    typedef std::vector<uint32_t,AlignedAllocator<uint32_t>> index_array;
+
+    //------------------------------------------------------------------------------------------------------------------
+    /// @brief reference to a pair of x,y components stored in two arrays
+    //------------------------------------------------------------------------------------------------------------------
+    class Vec2Ref
+    {
+    public:
+        float& m_x;
+        float& m_y;
+
+        Vec2Ref(float& _x, float& _y) : m_x(_x), m_y(_y) {}
+        Vec2Ref(const Vec2Ref& _other) : m_x(_other.m_x), m_y(_other.m_y) {}
+
+        operator vec2() const                       {return vec2(m_x,m_y);}
+        Vec2Ref& operator=(const vec2& _v)          {m_x = _v.m_x; m_y = _v.m_y; return *this;}
+        Vec2Ref& operator=(const Vec2Ref& _other)   {m_x = _other.m_x; m_y = _other.m_y; return *this;}
+        Vec2Ref& operator+=(const vec2& _v)         {m_x += _v.m_x; m_y += _v.m_y; return *this;}
+        Vec2Ref& operator-=(const vec2& _v)         {m_x -= _v.m_x; m_y -= _v.m_y; return *this;}
+        vec2 operator+(const vec2& _v) const        {return vec2(m_x+_v.m_x,m_y+_v.m_y);}
+        vec2 operator-(const vec2& _v) const        {return vec2(m_x-_v.m_x,m_y-_v.m_y);}
+    };
+
+    //------------------------------------------------------------------------------------------------------------------
+    /// @brief reference to a particle stored in the pool, with the same members as Particle
+    //------------------------------------------------------------------------------------------------------------------
+    class reference
+    {
+    public:
+        uint32_t& m_cellIndex;
+        Vec2Ref m_position;
+        Vec2Ref m_velocity;
+
+        reference(ParticlePool& _pool, size_t _i) :
+            m_cellIndex(_pool.m_cellIndex[_i]),
+            m_position(_pool.m_positionX[_i],_pool.m_positionY[_i]),
+            m_velocity(_pool.m_velocityX[_i],_pool.m_velocityY[_i]) {}
+
+        operator Particle() const
+        {
+            Particle p(m_position,m_velocity);
+            p.m_cellIndex = m_cellIndex;
+            return p;
+        }
+
+        reference& operator=(const Particle& _p)
+        {
+            m_cellIndex = static_cast<uint32_t>(_p.m_cellIndex);
+            m_position = _p.m_position;
+            m_velocity = _p.m_velocity;
+            return *this;
+        }
+    };
+
+    //------------------------------------------------------------------------------------------------------------------
+    /// @brief iterator over the particles. Dereferencing gives a reference proxy, so use auto&& in range for loops
+    //------------------------------------------------------------------------------------------------------------------
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Particle value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef ParticlePool::reference reference;
+        typedef void pointer;
+
+        iterator(ParticlePool* _pool, size_t _i) : m_pool(_pool), m_i(_i) {}
+
+        reference operator*() const                 {return reference(*m_pool,m_i);}
+        iterator& operator++()                      {++m_i; return *this;}
+        iterator operator++(int)                    {iterator it = *this; ++m_i; return it;}
+        bool operator==(const iterator& _other) const   {return m_i == _other.m_i;}
+        bool operator!=(const iterator& _other) const   {return m_i != _other.m_i;}
+        size_t index() const                        {return m_i;}
+
+    private:
+        ParticlePool* m_pool;
+        size_t m_i;
+    };
+
+    ParticlePool() {}
+
+    size_t size() const                             {return m_positionX.size();}
+    bool empty() const                              {return m_positionX.empty();}
+
+    void reserve(size_t _size);
+    void resize(size_t _size);
+    void clear();
+    void push_back(const Particle& _p);
+    void swap(ParticlePool& _other);
+
+    //moves particle i of this pool to _destination[i] in _out
+    void scatter(const std::vector<uint32_t>& _destination, ParticlePool& _out) const;
+
+    reference operator[](size_t _i)                 {return reference(*this,_i);}
+    Particle at(size_t _i) const;
+
+    vec2 position(size_t _i) const                  {return vec2(m_positionX[_i],m_positionY[_i]);}
+    vec2 velocity(size_t _i) const                  {return vec2(m_velocityX[_i],m_velocityY[_i]);}
+
+    iterator begin()                                {return iterator(this,0);}
+    iterator end()                                  {return iterator(this,size());}
+
+    //direct access to the arrays
+    float* positionX()                              {return m_positionX.data();}
+    float* positionY()                              {return m_positionY.data();}
+    float* velocityX()                              {return m_velocityX.data();}
+    float* velocityY()                              {return m_velocityY.data();}
+    uint32_t* cellIndex()                           {return m_cellIndex.data();}
+
+    const float* positionX() const                  {return m_positionX.data();}
+    const float* positionY() const                  {return m_positionY.data();}
+    const float* velocityX() const                  {return m_velocityX.data();}
+    const float* velocityY() const                  {return m_velocityY.data();}
+    const uint32_t* cellIndex() const               {return m_cellIndex.data();}
+
+private:
+    float_array m_positionX;
+    float_array m_positionY;
+    float_array m_velocityX;
+    float_array m_velocityY;
+
+    //32 bit cell indices are enough for 2^32 cells and keep the working set small
+    index_array m_cellIndex;
+};
+
+#endif // PARTICLEPOOL_H
@@ -0,0 +1,101 @@
+#ifndef PRESSUREMULTIGRID_H
+#define PRESSUREMULTIGRID_H
+
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Sparse>
+
+#include <vector>
+
+#include "pressureoperator.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PressureMultigridPreconditioner
+/// @brief Geometric multigrid V-cycle used as preconditioner for the conjugate gradient pressure solve.
+/// The levels are cell-indexed, the rows of the PressureOperator are scattered to the finest level and gathered back.
+/// The labels of the grid are restricted down a hierarchy of coarser levels, each one with half the columns and rows
+/// of the previous. A coarse cell is EMPTY if any of its children is EMPTY, so the free surface (pressure = 0) is kept
+/// at every level, FLUID if any of its children is FLUID and SOLID otherwise. Cells outside a level count as SOLID.
+/// Every level applies the same 5-point stencil as the PressureOperator, built from its own labels.
+///
+/// The residual is restricted by averaging the FLUID children and the correction is prolongated back by injection.
+/// With these transfers the Galerkin coarse operator R*A*P of the 5-point stencil has half the scale of the fine one,
+/// so every level uses half the scale of the previous. A piecewise constant prolongation underestimates the smooth
+/// error, so the coarse correction is multiplied by overCorrection(), 2 by default as usual for aggregation multigrid.
+/// 1 gives the plain Galerkin correction, which needs about four times the iterations on large grids.
+/// The smoother is a red-black Gauss-Seidel with the colours swapped between pre and post smoothing, so the V-cycle is
+/// symmetric as the conjugate gradient requires. One cycle costs O(N) and the number of iterations barely depends on
+/// the grid resolution.
+///
+/// When only a few cells changed label since the last factorize(), update() patches the finest labels and restricts
+/// again only the parents of those cells, level by level. It falls back to factorize() when more than
+/// rebuildFraction() of the cells changed, as the full restriction is then cheaper. The pressure solver sets it to the
+/// fraction FluidSimulator uses to rebuild the operator, so both take the same decision.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+class PressureMultigridPreconditioner
+{
+public:
+    typedef Eigen::VectorXd Vector;
+
+    PressureMultigridPreconditioner()               {m_operator = nullptr;}
+    explicit PressureMultigridPreconditioner(const PressureOperator& _operator) {compute(_operator);}
+
+    PressureMultigridPreconditioner& analyzePattern(const PressureOperator&)   {return *this;}
+    PressureMultigridPreconditioner& factorize(const PressureOperator& _operator);
+    PressureMultigridPreconditioner& compute(const PressureOperator& _operator) {return factorize(_operator);}
+    PressureMultigridPreconditioner& update(const PressureOperator& _operator, const std::vector<size_t>& _changedCells);
+
+    template<typename Rhs>
+    Vector solve(const Eigen::MatrixBase<Rhs>& _b) const
+    {
+        Vector x(_b.size());
+        Eigen::Ref<const Vector> b(_b.derived());
+        applyInverse(b.data(),x.data());
+        return x;
+    }
+
+    Eigen::ComputationInfo info()                   {return Eigen::Success;}
+
+    //one V-cycle on A*_x = _b, starting from _x = 0
+    void applyInverse(const double* _b, double* _x) const;
+
+    size_t levels() const                           {return m_levels.size();}
+    size_t smoothingSteps() const                   {return m_smoothingSteps;}
+    void setSmoothingSteps(size_t _steps)           {m_smoothingSteps = _steps;}
+    double overCorrection() const                   {return m_overCorrection;}
+    void setOverCorrection(double _factor)          {m_overCorrection = _factor;}
+    double rebuildFraction() const                  {return m_rebuildFraction;}
+    void setRebuildFraction(double _fraction)       {m_rebuildFraction = _fraction;}
+
+private:
+    struct Level
+    {
+        size_t m_nColumns;
+        size_t m_nRows;
+        double m_scale;
+        std::vector<Label> m_label;
+
+        //solution, right hand side and residual of the level
+        mutable std::vector<double> m_x;
+        mutable std::vector<double> m_b;
+        mutable std::vector<double> m_r;
+    };
+
+    void restrictLabels(const Level& _fine, Level& _coarse) const;
+    Label restrictLabel(const Level& _fine, size_t _column, size_t _row) const;
+    void smooth(const Level& _level, size_t _colour) const;
+    void residual(const Level& _level) const;
+    void vCycle(size_t _level) const;
+
+    const PressureOperator* m_operator;
+    std::vector<Level> m_levels;
+
+    size_t m_smoothingSteps = 2;
+    size_t m_coarseSteps = 20;
+    double m_rebuildFraction = 0.1;
+    double m_overCorrection = 2.0;
+};
+
+#endif // PRESSUREMULTIGRID_H
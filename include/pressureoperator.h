@@ -0,0 +1,228 @@
+#ifndef PRESSUREOPERATOR_H
+#define PRESSUREOPERATOR_H
+
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Sparse>
+#include <eigen3/Eigen/IterativeLinearSolvers>
+
+#include <vector>
+
+#include "grid.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @enum preconditioners available to the conjugate gradient pressure solver
+enum class PressurePreconditioner{ DIAGONAL, MIC, MULTIGRID };
+
+class PressureOperator;
+
+namespace Eigen {
+namespace internal {
+//the operator is seen by Eigen as a sparse matrix of doubles
+template<>
+struct traits<PressureOperator> : public Eigen::internal::traits<Eigen::SparseMatrix<double> >
+{};
+}
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PressureOperator
+/// @brief Matrix-free version of the pressure matrix A described in (Bridson,2011).
+/// The 5-point Laplacian is applied straight from the grid labels, so nothing is assembled when the labels change.
+/// Only the FLUID cells are unknowns: setUp numbers them in cell order and the operator works on that compact vector,
+/// so the SOLID and EMPTY cells cost nothing to the solver. row() and cell() map between the two numberings.
+/// Each row has scale*(number of non SOLID neighbours) on the diagonal and -scale for every FLUID neighbour, with
+/// scale = timeStep/(dx*dx). Cells outside the grid count as SOLID.
+/// The density of the cell is moved to the right hand side (see FluidSimulator::pressureSolve), which gives the same
+/// solution of the per row density scale and keeps the operator symmetric, as conjugate gradient requires.
+///
+/// setUp stores the stencil of every cell in one byte, the FLUID neighbours and the count of non SOLID ones. Between
+/// two substeps only a thin band of cells around the free surface changes label, so update() patches the bytes of
+/// those cells and of their neighbours and renumbers the rows, instead of rebuilding the whole stencil.
+///
+/// The class plugs into the Eigen iterative solvers, e.g. ConjugateGradient<PressureOperator,Lower|Upper,
+/// PressureJacobiPreconditioner>, following the Eigen matrix-free solver interface.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+class PressureOperator : public Eigen::EigenBase<PressureOperator>
+{
+public:
+    typedef double Scalar;
+    typedef double RealScalar;
+    typedef int StorageIndex;
+    enum
+    {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic,
+        IsRowMajor = false
+    };
+
+    PressureOperator();
+
+    Eigen::Index rows() const                       {return static_cast<Eigen::Index>(m_size);}
+    Eigen::Index cols() const                       {return static_cast<Eigen::Index>(m_size);}
+
+    template<typename Rhs>
+    Eigen::Product<PressureOperator,Rhs,Eigen::AliasFreeProduct> operator*(const Eigen::MatrixBase<Rhs>& _x) const
+    {
+        return Eigen::Product<PressureOperator,Rhs,Eigen::AliasFreeProduct>(*this,_x.derived());
+    }
+
+    void setUp(Grid* _grid, float _timeStep);
+
+    //same as setUp when only _changedCells changed label since the last set up. Falls back to setUp for a new grid
+    void update(Grid* _grid, float _timeStep, const std::vector<size_t>& _changedCells);
+
+    Grid* grid() const                              {return m_grid;}
+    double scale() const                            {return m_scale;}
+
+    //cell of a row, and row of a cell (-1 for the non FLUID cells)
+    size_t cell(size_t _row) const                  {return m_fluidCells[_row];}
+    int row(size_t _cell) const                     {return m_cellRow[_cell];}
+
+    //_y = A*_x
+    void apply(const double* _x, double* _y) const;
+    double diagonal(size_t _row) const;
+
+    //coefficient between the row and the row of its E neighbour, and between the row and the row of its N neighbour
+    double plusU(size_t _row) const;
+    double plusV(size_t _row) const;
+
+    //assembled version of the same operator
+    Eigen::SparseMatrix<double,Eigen::RowMajor> toSparseMatrix() const;
+
+    //scratch vector used by the Eigen product
+    Eigen::VectorXd& product() const                {return m_product;}
+
+    //rows of the FLUID neighbours of a row, terminated by -1 when fewer than 4, and number of non SOLID neighbours
+    size_t stencil(size_t _row, int* _fluidNeighbours) const;
+
+private:
+    void setUpStencil(size_t _cell, size_t _x, size_t _y);
+    void setUpRows(bool _stencil);
+
+    Grid* m_grid;
+    size_t m_size;
+    double m_scale;
+
+    //stencil of each cell: bits 0-3 flag the FLUID neighbours W,E,S,N, bits 4-6 count the non SOLID neighbours
+    std::vector<unsigned char> m_cellStencil;
+
+    //compact numbering of the FLUID cells
+    std::vector<size_t> m_fluidCells;
+    std::vector<int> m_cellRow;
+
+    mutable Eigen::VectorXd m_product;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PressureJacobiPreconditioner
+/// @brief Diagonal preconditioner for the PressureOperator, equivalent to Eigen::DiagonalPreconditioner on the
+/// assembled matrix.
+//----------------------------------------------------------------------------------------------------------------------
+class PressureJacobiPreconditioner
+{
+public:
+    typedef Eigen::VectorXd Vector;
+
+    PressureJacobiPreconditioner() {}
+    explicit PressureJacobiPreconditioner(const PressureOperator& _operator) {compute(_operator);}
+
+    PressureJacobiPreconditioner& analyzePattern(const PressureOperator&)   {return *this;}
+    PressureJacobiPreconditioner& factorize(const PressureOperator& _operator);
+    PressureJacobiPreconditioner& compute(const PressureOperator& _operator) {return factorize(_operator);}
+
+    template<typename Rhs>
+    auto solve(const Eigen::MatrixBase<Rhs>& _b) const -> decltype(Vector().cwiseProduct(_b.derived()))
+    {
+        return m_inverseDiagonal.cwiseProduct(_b.derived());
+    }
+
+    Eigen::ComputationInfo info()                   {return Eigen::Success;}
+
+private:
+    Vector m_inverseDiagonal;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PressureMICPreconditioner
+/// @brief Modified Incomplete Cholesky, MIC(0), preconditioner for the PressureOperator as described in
+/// (Bridson,2011). It is specialised for the 5-point stencil: the factor has the sparsity of the lower part of A,
+/// so only one value per cell is stored. The dropped fill-in is added back to the diagonal (tuning constant tau) and
+/// small pivots are replaced by the diagonal of A (safety constant sigma).
+/// The number of conjugate gradient iterations grows roughly with the square root of the grid resolution, instead of
+/// linearly as with the diagonal preconditioner.
+//----------------------------------------------------------------------------------------------------------------------
+class PressureMICPreconditioner : public Eigen::SparseSolverBase<PressureMICPreconditioner>
+{
+public:
+    typedef Eigen::VectorXd Vector;
+    typedef double Scalar;
+    typedef int StorageIndex;
+    enum
+    {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    PressureMICPreconditioner();
+    explicit PressureMICPreconditioner(const PressureOperator& _operator);
+
+    PressureMICPreconditioner& analyzePattern(const PressureOperator&)   {return *this;}
+    PressureMICPreconditioner& factorize(const PressureOperator& _operator);
+    PressureMICPreconditioner& compute(const PressureOperator& _operator) {return factorize(_operator);}
+
+    Eigen::Index rows() const                       {return static_cast<Eigen::Index>(m_precon.size());}
+    Eigen::Index cols() const                       {return static_cast<Eigen::Index>(m_precon.size());}
+
+    Eigen::ComputationInfo info()                   {return Eigen::Success;}
+
+    //solves L*L^T*_x = _b, called by SparseSolverBase::solve
+    template<typename Rhs, typename Dest>
+    void _solve_impl(const Rhs& _b, Dest& _x) const
+    {
+        Eigen::Ref<const Eigen::VectorXd> b(_b);
+        _x.resize(b.size());
+        applyInverse(b.data(),_x.data());
+    }
+
+    void applyInverse(const double* _b, double* _x) const;
+
+    double tau() const                              {return m_tau;}
+    double sigma() const                            {return m_sigma;}
+    void setTau(double _tau)                        {m_tau = _tau;}
+    void setSigma(double _sigma)                    {m_sigma = _sigma;}
+
+private:
+    const PressureOperator* m_operator;
+    std::vector<double> m_precon;
+    mutable std::vector<double> m_q;
+
+    double m_tau = 0.97;
+    double m_sigma = 0.25;
+};
+
+namespace Eigen {
+namespace internal {
+//product between the operator and a dense vector, used by the Eigen iterative solvers
+template<typename Rhs>
+struct generic_product_impl<PressureOperator,Rhs,SparseShape,DenseShape,GemvProduct>
+        : generic_product_impl_base<PressureOperator,Rhs,generic_product_impl<PressureOperator,Rhs> >
+{
+    typedef typename Product<PressureOperator,Rhs>::Scalar Scalar;
+
+    template<typename Dest>
+    static void scaleAndAddTo(Dest& _dst, const PressureOperator& _lhs, const Rhs& _rhs, const Scalar& _alpha)
+    {
+        Eigen::Ref<const Eigen::VectorXd> x(_rhs);
+        Eigen::VectorXd& y = _lhs.product();
+        y.resize(x.size());
+        _lhs.apply(x.data(),y.data());
+        _dst += _alpha*y;
+    }
+};
+}
+}
+
+#endif // PRESSUREOPERATOR_H
@@ -0,0 +1,281 @@
+#ifndef PRESSURESOLVER_H
+#define PRESSURESOLVER_H
+
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/IterativeLinearSolvers>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "parallel.h"
+#include "pressureoperator.h"
+#include "pressuremultigrid.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @enum algorithms available to solve the pressure
+enum class PressureSolverType{ CONJUGATE_GRADIENT, RED_BLACK_SOR, MIXED_PRECISION };
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @struct PressureSolverStats
+/// @brief Outcome of the last solve: iterations, relative residual |b-Ax|/|b| and convergence.
+//----------------------------------------------------------------------------------------------------------------------
+struct PressureSolverStats
+{
+    size_t m_iterations = 0;
+    double m_error = 0.0;
+    bool m_converged = false;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @struct PressureSolveRecord
+/// @brief Telemetry of the pressure solve of one substep: size of the system, outcome of the solver and wall-clock
+/// times, in milliseconds, spent setting up the system (operator, right hand side, solver and warm start) and solving it.
+//----------------------------------------------------------------------------------------------------------------------
+struct PressureSolveRecord
+{
+    size_t m_substep = 0;
+    const char* m_solver = "";
+    size_t m_size = 0;
+    PressureSolverStats m_stats;
+    bool m_warmStart = false;
+    long m_iterationsSaved = 0;
+    double m_setUpTime = 0.0;
+    double m_solveTime = 0.0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PressureSolver
+/// @brief Interface of the algorithms solving A*x = b for the PressureOperator.
+/// prepare() is called once per substep, after the operator has been set up, and may precompute anything that only
+/// depends on A (e.g. a preconditioner). update() replaces prepare() when only a few cells changed label since the
+/// previous call, so the solvers able to patch what they precomputed do not rebuild it. solve() then finds x, starting
+/// from the value of x when _guess is true and from zero otherwise. stats() describes the last solve.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+class PressureSolver
+{
+public:
+    virtual ~PressureSolver() {}
+
+    virtual const char* name() const = 0;
+
+    virtual void prepare(const PressureOperator& _operator) = 0;
+    virtual void update(const PressureOperator& _operator, const std::vector<size_t>&)   {prepare(_operator);}
+    virtual bool solve(const Eigen::VectorXd& _b, Eigen::VectorXd& _x, bool _guess) = 0;
+
+    const PressureSolverStats& stats() const        {return m_stats;}
+
+    //relative residual to reach, and iteration cap. 0 iterations uses the default of the solver. The tolerance is
+    //clamped to minTolerance(), the smallest residual the solver can reliably reach
+    double tolerance() const                        {return m_tolerance;}
+    double minTolerance() const                     {return m_minTolerance;}
+    size_t maxIterations() const                    {return m_maxIterations;}
+    void setTolerance(double _tolerance)            {m_tolerance = std::max(_tolerance,m_minTolerance);}
+    void setMaxIterations(size_t _iterations)       {m_maxIterations = _iterations;}
+
+    //fraction of the cells that may change label before a patching update() rebuilds what it precomputed instead
+    double rebuildFraction() const                  {return m_rebuildFraction;}
+    void setRebuildFraction(double _fraction)       {m_rebuildFraction = _fraction;}
+
+    //threads the solver may use, ignored by the serial solvers
+    size_t threadCount() const                      {return m_threadCount;}
+    void setThreadCount(size_t _count)              {m_threadCount = _count>0 ? _count : 1;}
+
+protected:
+    PressureSolverStats m_stats;
+    double m_tolerance = Eigen::NumTraits<double>::epsilon();
+    double m_minTolerance = 0.0;
+    size_t m_maxIterations = 0;
+    double m_rebuildFraction = 0.1;
+    size_t m_threadCount = 1;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief refreshes a preconditioner after the labels of _changedCells changed. The row-based ones are computed again,
+/// as every new FLUID cell shifts the rows after it, the multigrid patches its cell-indexed levels up to
+/// _rebuildFraction of changed cells
+template<typename Preconditioner>
+void updatePreconditioner(Preconditioner& _preconditioner, const PressureOperator& _operator, const std::vector<size_t>&,
+                          double)
+{
+    _preconditioner.compute(_operator);
+}
+
+inline void updatePreconditioner(PressureMultigridPreconditioner& _preconditioner, const PressureOperator& _operator,
+                                 const std::vector<size_t>& _changedCells, double _rebuildFraction)
+{
+    _preconditioner.setRebuildFraction(_rebuildFraction);
+    _preconditioner.update(_operator,_changedCells);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PressureConjugateGradient
+/// @brief Eigen conjugate gradient on the matrix-free operator, with one of the pressure preconditioners.
+//----------------------------------------------------------------------------------------------------------------------
+template<typename Preconditioner>
+class PressureConjugateGradient : public PressureSolver
+{
+public:
+    const char* name() const                        {return "Conjugate Gradient";}
+
+    void prepare(const PressureOperator& _operator)
+    {
+        m_cg.setTolerance(m_tolerance);
+        if(m_maxIterations > 0)
+            m_cg.setMaxIterations(static_cast<Eigen::Index>(m_maxIterations));
+        m_cg.compute(_operator);
+    }
+
+    void update(const PressureOperator& _operator, const std::vector<size_t>& _changedCells)
+    {
+        m_cg.setTolerance(m_tolerance);
+        if(m_maxIterations > 0)
+            m_cg.setMaxIterations(static_cast<Eigen::Index>(m_maxIterations));
+
+        //binds the operator without computing the preconditioner, which is then patched
+        m_cg.analyzePattern(_operator);
+        updatePreconditioner(m_cg.preconditioner(),_operator,_changedCells,m_rebuildFraction);
+    }
+
+    bool solve(const Eigen::VectorXd& _b, Eigen::VectorXd& _x, bool _guess)
+    {
+        if(_guess)
+        {
+            Eigen::VectorXd guess = _x;
+            _x = m_cg.solveWithGuess(_b,guess);
+        }
+        else
+        {
+            _x = m_cg.solve(_b);
+        }
+
+        m_stats.m_iterations = static_cast<size_t>(m_cg.iterations());
+        m_stats.m_error = m_cg.error();
+        m_stats.m_converged = m_cg.info() == Eigen::Success;
+        return m_stats.m_converged;
+    }
+
+    Preconditioner& preconditioner()                {return m_cg.preconditioner();}
+
+private:
+    Eigen::ConjugateGradient<PressureOperator,Eigen::Lower|Eigen::Upper,Preconditioner> m_cg;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PressureRedBlackSOR
+/// @brief Red-black successive over-relaxation on the FLUID rows, Gauss-Seidel for omega = 1.
+/// The cells of one colour only depend on the cells of the other, so every colour sweep is split across threads
+/// without changing the result. The threads are spawned once per solve and synchronised by a barrier between the
+/// sweeps. prepare() stores the stencil of each colour as flat arrays, the missing neighbours pointing to a zero
+/// padding value, so the inner loop has no branches and the compiler can vectorise it.
+///
+/// solve() stops as soon as the relative residual, checked every checkInterval() iterations, reaches the tolerance.
+/// Cheap per iteration, but it needs many more iterations than the preconditioned conjugate gradient on large grids,
+/// so it is meant for previews. Machine precision is out of reach of a stationary method, its minTolerance() is 1e-14.
+//----------------------------------------------------------------------------------------------------------------------
+class PressureRedBlackSOR : public PressureSolver
+{
+public:
+    PressureRedBlackSOR();
+
+    const char* name() const                        {return "Red-Black SOR";}
+
+    void prepare(const PressureOperator& _operator);
+    bool solve(const Eigen::VectorXd& _b, Eigen::VectorXd& _x, bool _guess);
+
+    double omega() const                            {return m_omega;}
+    void setOmega(double _omega)                    {m_omega = _omega;}
+    size_t checkInterval() const                    {return m_checkInterval;}
+    void setCheckInterval(size_t _interval)         {m_checkInterval = _interval>0 ? _interval : 1;}
+
+private:
+    //stencil of the rows of one colour
+    struct Colour
+    {
+        std::vector<int> m_row;
+        std::vector<int> m_neighbour[4];
+        std::vector<double> m_count;
+        std::vector<double> m_inverseCount;
+    };
+
+    void prepareColour(Colour& _colour) const;
+    void sweep(const Colour& _colour, size_t _begin, size_t _end);
+    double residual(const Colour& _colour, size_t _begin, size_t _end) const;
+    void load(const Eigen::VectorXd& _b, const Eigen::VectorXd& _x, bool _guess);
+    size_t iterate(size_t _iterations);
+
+    const PressureOperator* m_operator;
+    Colour m_colour[2];
+
+    //solution and right hand side scaled by 1/scale, with one padding zero at the end
+    std::vector<double> m_x;
+    std::vector<double> m_b;
+    std::vector<double> m_partialResidual;
+
+    double m_omega = 1.0;
+    size_t m_checkInterval = 4;
+    size_t m_minRowsPerThread = 4096;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class PressureMixedPrecisionCG
+/// @brief Conjugate gradient run in float, wrapped in an iterative refinement in double.
+/// Each refinement computes the residual r = b - A*x in double, solves A*d = r in float and adds d to x. The float
+/// solve is asked for the reduction still missing, but no more than innerTolerance(), the limit of float precision.
+/// The inner conjugate gradient works on a float copy of the stencil built by prepare(), uses the diagonal
+/// preconditioner and accumulates its dot products in double. Its iterations move half the bytes of the double ones,
+/// while the double residual lets the solution reach the tolerances of the double solvers.
+/// The refinement stops at the tolerance, when the residual stops decreasing or after maxRefinements() steps. The
+/// rounding of the double residual stalls it around 1e-15, so its minTolerance() is 1e-14.
+//----------------------------------------------------------------------------------------------------------------------
+class PressureMixedPrecisionCG : public PressureSolver
+{
+public:
+    PressureMixedPrecisionCG();
+
+    const char* name() const                        {return "Mixed Precision Conjugate Gradient";}
+
+    void prepare(const PressureOperator& _operator);
+    bool solve(const Eigen::VectorXd& _b, Eigen::VectorXd& _x, bool _guess);
+
+    double innerTolerance() const                   {return m_innerTolerance;}
+    void setInnerTolerance(double _tolerance)       {m_innerTolerance = _tolerance;}
+    size_t maxRefinements() const                   {return m_maxRefinements;}
+    void setMaxRefinements(size_t _refinements)     {m_maxRefinements = _refinements;}
+    size_t refinements() const                      {return m_refinements;}
+
+private:
+    size_t innerSolve(double _tolerance, size_t _maxIterations);
+    void apply(const float* _x, float* _y) const;
+
+    const PressureOperator* m_operator;
+
+    //float copy of the operator: diagonal, rows of the 4 neighbours (the missing ones point to a zero padding entry
+    //at the end of m_p) and off-diagonal value
+    std::vector<float> m_diagonal;
+    std::vector<int> m_neighbour[4];
+    float m_offDiagonal = 0.0f;
+
+    //float vectors of the inner conjugate gradient, solving A*m_d = m_r
+    std::vector<float> m_inverseDiagonal;
+    std::vector<float> m_r;
+    std::vector<float> m_d;
+    std::vector<float> m_z;
+    std::vector<float> m_p;
+    std::vector<float> m_q;
+
+    Eigen::VectorXd m_residual;
+
+    double m_innerTolerance = 1e-5;
+    size_t m_maxRefinements = 20;
+    size_t m_refinements = 0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief creates the solver of the given type. The preconditioner only applies to the conjugate gradient
+std::unique_ptr<PressureSolver> createPressureSolver(PressureSolverType _type, PressurePreconditioner _preconditioner);
+
+#endif // PRESSURESOLVER_H
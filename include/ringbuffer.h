@@ -0,0 +1,64 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <cstddef>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class RingBuffer
+/// @brief Fixed capacity history of values. push() overwrites the oldest value once the buffer is full, so recording
+/// never allocates after setCapacity(). Index 0 is the oldest value still stored, size()-1 the newest.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+template<typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t _capacity = 0) : m_values(_capacity), m_begin(0), m_size(0) {}
+
+    size_t size() const                             {return m_size;}
+    size_t capacity() const                         {return m_values.size();}
+    bool empty() const                              {return m_size == 0;}
+
+    const T& operator[](size_t _index) const        {return m_values[(m_begin+_index)%m_values.size()];}
+    const T& back() const                           {return (*this)[m_size-1];}
+
+    void push(const T& _value)
+    {
+        if(m_values.empty())
+            return;
+
+        if(m_size < m_values.size())
+        {
+            m_values[(m_begin+m_size)%m_values.size()] = _value;
+            ++m_size;
+        }
+        else
+        {
+            m_values[m_begin] = _value;
+            m_begin = (m_begin+1)%m_values.size();
+        }
+    }
+
+    void clear()
+    {
+        m_begin = 0;
+        m_size = 0;
+    }
+
+    //drops the stored values. A capacity of 0 disables the recording
+    void setCapacity(size_t _capacity)
+    {
+        m_values.assign(_capacity,T());
+        clear();
+    }
+
+private:
+    std::vector<T> m_values;
+    size_t m_begin;
+    size_t m_size;
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,101 @@
+#ifndef SIMULATIONWORKER_H
+#define SIMULATIONWORKER_H
+
+#include <ngl/Vec3.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fluidsimulator.h"
+#include "triplebuffer.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @struct FrameSnapshot
+/// @brief Visualisation data of one simulated frame. The velocity field and the active cells are only prepared when
+/// requested, see SimulationWorker::setSnapshotContent. report describes the frame, its budget is infinite when the
+/// frame budget is 0.
+//----------------------------------------------------------------------------------------------------------------------
+struct FrameSnapshot
+{
+    size_t m_frame = 0;
+    std::vector<ngl::Vec3> m_particles;
+    std::vector<ngl::Vec3> m_activeCells;
+    std::vector<ngl::Vec3> m_velocityField;
+    FrameBudgetReport m_report;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class SimulationWorker
+/// @brief Runs the FluidSimulator on its own thread, so the View draws at its own rate while the simulation runs as
+/// fast as it can. After every frame the worker publishes a FrameSnapshot through a TripleBuffer: the View takes the
+/// newest one with acquireSnapshot() and draws it, without ever waiting for the simulation.
+/// Once the worker is created only its thread touches the simulator. The controls are commands executed by the worker
+/// between two frames, and a paused worker sleeps until it receives one.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+class SimulationWorker
+{
+    typedef ngl::Vec3 vec3;
+
+public:
+    explicit SimulationWorker(FluidSimulator* _simulator);
+    ~SimulationWorker();
+
+    //commands
+    void togglePlay();
+    void nextFrame();
+    void setPressureSolverMode(bool _mode);
+
+    //data prepared for each snapshot, the particles are always included. A change republishes the current frame
+    void setSnapshotContent(bool _velocityField, bool _activeCells);
+
+    //wall-clock budget in milliseconds of each frame, see FluidSimulator::advanceFrame(double). 0 runs the full frame
+    void setFrameBudget(double _budget);
+
+    //reader side, for the GUI thread. acquireSnapshot() returns true when a newer frame became current
+    bool acquireSnapshot()                          {return m_snapshots.update();}
+    const FrameSnapshot& snapshot() const           {return m_snapshots.front();}
+
+    //grid geometry and SOLID cells, which never change, read before the thread started
+    float width() const                             {return m_width;}
+    float height() const                            {return m_height;}
+    size_t nColumns() const                         {return m_nColumns;}
+    size_t nRows() const                            {return m_nRows;}
+    const std::vector<vec3>& cellCentres() const    {return m_cellCentres;}
+    const std::vector<vec3>& boundaries() const     {return m_boundaries;}
+
+private:
+    void run();
+    void prepareSnapshot(bool _velocityField, bool _activeCells, const FrameBudgetReport& _report);
+
+    FluidSimulator* m_simulator;
+    float m_width;
+    float m_height;
+    size_t m_nColumns;
+    size_t m_nRows;
+    std::vector<vec3> m_cellCentres;
+    std::vector<vec3> m_boundaries;
+    TripleBuffer<FrameSnapshot> m_snapshots;
+    size_t m_frame = 0;
+
+    //commands, guarded by m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_quit = false;
+    bool m_playing = false;
+    size_t m_framesRequested = 0;
+    bool m_refreshRequested = false;
+    bool m_pressureSolverMode = false;
+    bool m_pressureSolverModeChanged = false;
+    bool m_snapshotVelocityField = false;
+    bool m_snapshotActiveCells = false;
+    double m_frameBudget = 0.0;
+
+    std::thread m_thread;
+};
+
+#endif // SIMULATIONWORKER_H
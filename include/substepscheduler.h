@@ -0,0 +1,80 @@
+#ifndef SUBSTEPSCHEDULER_H
+#define SUBSTEPSCHEDULER_H
+
+#include <cstddef>
+
+#include "ringbuffer.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @struct SubstepFrameRecord
+/// @brief Substeps taken by one frame: their number, shortest and longest step, the largest velocity seen and the
+/// largest CFL number actually used. budgetLimited is set when a step had to exceed the CFL number to keep the frame
+/// within maxSubsteps().
+//----------------------------------------------------------------------------------------------------------------------
+struct SubstepFrameRecord
+{
+    size_t m_frame = 0;
+    size_t m_substeps = 0;
+    float m_minTimeStep = 0.0f;
+    float m_maxTimeStep = 0.0f;
+    float m_maxVelocity = 0.0f;
+    float m_maxCFL = 0.0f;
+    bool m_budgetLimited = false;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class SubstepScheduler
+/// @brief Splits a frame in substeps following the CFL condition of (Bridson,2011): the fastest velocity moves at most
+/// cfl() cells in a substep, so the step is cfl()*dx/|u|max.
+/// The step may grow by at most maxGrowth() from one substep to the next, also across frames, so a calm substep does
+/// not jump to a step the next one can not keep, while it shrinks at once when the velocity grows. A step longer than
+/// half the time left is cut to half of it, to avoid a tiny last substep.
+/// A frame never runs more than maxSubsteps() substeps: when the time left can not be covered by the substeps left at
+/// the CFL step, the step is lengthened to fit and the frame is marked as budgetLimited in its record.
+///
+/// beginFrame() starts a frame, nextStep() gives the length of each substep until frameDone() and endFrame() stores
+/// the record of the frame in history().
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+class SubstepScheduler
+{
+public:
+    SubstepScheduler();
+
+    void beginFrame(float _frameTime);
+    float nextStep(float _maxVelocity, float _cellSize);
+    bool frameDone() const                          {return m_timeLeft <= 0.0f;}
+    void endFrame();
+
+    //time left in the frame, and estimate of the substeps it still needs at the current CFL step within the budget
+    float timeLeft() const                          {return m_timeLeft;}
+    size_t substepsLeft(float _maxVelocity, float _cellSize) const;
+
+    float cfl() const                               {return m_cfl;}
+    void setCFL(float _cfl)                         {m_cfl = _cfl;}
+    size_t maxSubsteps() const                      {return m_maxSubsteps;}
+    void setMaxSubsteps(size_t _substeps)           {m_maxSubsteps = _substeps>0 ? _substeps : 1;}
+    float maxGrowth() const                         {return m_maxGrowth;}
+    void setMaxGrowth(float _growth)                {m_maxGrowth = _growth;}
+
+    //record of the frame being run, and of the last frames
+    const SubstepFrameRecord& record() const        {return m_record;}
+    const RingBuffer<SubstepFrameRecord>& history() const   {return m_history;}
+    void setHistoryCapacity(size_t _capacity)       {m_history.setCapacity(_capacity);}
+
+private:
+    float m_cfl = 5.0f;
+    size_t m_maxSubsteps = 32;
+    float m_maxGrowth = 2.0f;
+
+    float m_timeLeft = 0.0f;
+    float m_lastStep = 0.0f;
+    size_t m_frame = 0;
+
+    SubstepFrameRecord m_record;
+    RingBuffer<SubstepFrameRecord> m_history;
+};
+
+#endif // SUBSTEPSCHEDULER_H
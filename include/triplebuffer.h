@@ -0,0 +1,55 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @class TripleBuffer
+/// @brief Lock-free hand-off of values from one writer thread to one reader thread.
+/// The writer fills back() and publish() swaps it with the middle slot, the reader calls update() to swap the front
+/// slot with the middle one when it holds a newer value, and reads front(). Each thread owns its slot until it swaps
+/// it, so neither waits for the other: the writer overwrites the values the reader never took, and the reader keeps
+/// its front value until a new one is published.
+///  @author Federico Leone
+///  @version 1.0
+///  @date
+//----------------------------------------------------------------------------------------------------------------------
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : m_back(0), m_middle(1), m_front(2) {}
+
+    //writer side
+    T& back()                                       {return m_slots[m_back];}
+    void publish()
+    {
+        unsigned middle = m_middle.exchange(m_back | s_fresh,std::memory_order_acq_rel);
+        m_back = middle & s_index;
+    }
+
+    //reader side. Returns true when front() changed
+    bool update()
+    {
+        if(!(m_middle.load(std::memory_order_relaxed) & s_fresh))
+            return false;
+
+        //only the writer sets the middle slot, always as fresh, so the exchange takes a fresh value
+        unsigned middle = m_middle.exchange(m_front,std::memory_order_acq_rel);
+        m_front = middle & s_index;
+        return true;
+    }
+    const T& front() const                          {return m_slots[m_front];}
+
+private:
+    //the middle slot index is stored with a flag telling whether the writer published it after the last update
+    static const unsigned s_index = 3;
+    static const unsigned s_fresh = 4;
+
+    T m_slots[3];
+    unsigned m_back;
+    std::atomic<unsigned> m_middle;
+    unsigned m_front;
+};
+
+#endif // TRIPLEBUFFER_H
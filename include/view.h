@@ -9,12 +9,15 @@
 
 #include "windowparams.h"
 #include "FluidSimulator.h"
+#include "simulationworker.h"
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @class View
 /// @brief The View class is the View component in the MVC design pattern.
 /// The class receives the settings from the Control, retreives information from the Model (FluidSimulator class)
 /// and displays the data.
+/// The simulation runs on the thread of a SimulationWorker: the View draws the newest frame it published, at 60 fps,
+/// whatever the rate of the simulation. It never touches the simulator, the grid geometry also comes from the worker.
 /// It is also responsible to initialise the openGL context and assemble and store the geometric data.
 ///
 /// Originally based on class NGLScene from https://github.com/NCCA/SimpleNGL.git
@@ -28,10 +31,10 @@ class View : public QOpenGLWidget
 {
     typedef ngl::Vec3 vec3;
 public:
-    View(QWidget *_parent, FluidSimulator *_fluidSimulator);
+    View(QWidget *_parent, SimulationWorker *_simulationWorker);
     ~View();
 
-    void setFluidSimulator(FluidSimulator* _fluidSimulator);
+    void setSimulationWorker(SimulationWorker* _simulationWorker);
 
     void velocityField(const std::vector<vec3> &_data);
     void velocityFieldUpdate(const std::vector<vec3>& _data);
@@ -47,9 +50,6 @@ public:
     void setDisplayActiveCells(bool _mode)              {m_displayActiveCells=_mode;}
     void setBoundaries(bool _mode)                      {m_displayBoundaries=_mode;}
 
-    void togglePlaySimulation();
-    void togglePlayNextFrame();
-
 protected:
     void resizeGL(int _w, int _h);
     void initializeGL();
@@ -69,7 +69,7 @@ private:
     ngl::Transformation m_transform;
     ngl::Camera m_camera;
 
-    FluidSimulator* m_fluidSimulator;
+    SimulationWorker* m_simulationWorker;
     std::unique_ptr<ngl::AbstractVAO> m_velocityFieldVao;
     size_t m_velocityFieldVaoSize;
 
@@ -88,11 +88,6 @@ private:
     bool m_displayParticles;
     bool m_displayActiveCells;
     bool m_displayBoundaries;
-
-    bool m_playSimulation;
-    bool m_playNextFrame;
-
-    float m_time;
 };
 
 #endif // VIEW_H
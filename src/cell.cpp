@@ -1,6 +1,8 @@
 #include "cell.h"
+#include "grid.h"
 #include <limits.h>
 #include <cmath>
+#include <stdexcept>
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @file cell.cpp
@@ -8,262 +10,250 @@
 //----------------------------------------------------------------------------------------------------------------------
 Cell::Cell()
 {
-    setLabel(Label::EMPTY);
-    setStatus(Status::INACTIVE);
+    m_grid = nullptr;
     m_index = UINT_MAX;
-
-    m_minU = 0.0f;
-    m_minV = 0.0f;
-    m_maxU = 0.0f;
-    m_maxV = 0.0f;
-
-    m_deltaU = m_maxU - m_minU;
-    m_deltaV = m_maxV - m_minV;
-
-    m_centre.m_x = m_minU + m_deltaU/2;
-    m_centre.m_y = m_minV + m_deltaV/2;
-
-    m_halfEdge['N'] = vec2(m_centre.m_x,m_maxV);
-    m_halfEdge['S'] = vec2(m_centre.m_x,m_minV);
-    m_halfEdge['E'] = vec2(m_maxU,m_centre.m_y);
-    m_halfEdge['W'] = vec2(m_minU,m_centre.m_y);
-
-    m_particlePoolSize = 0;
-    m_particleCount = 0;
-
-    m_initialVelocityU = nullptr;
-    m_velocityU = nullptr;
-    m_deltaVelocityU = nullptr;
-    m_initialVelocityV = nullptr;
-    m_velocityV = nullptr;
-    m_deltaVelocityV = nullptr;
-    m_pressure = nullptr;
-
-    m_neighbour['N'] = nullptr;
-    m_neighbour['S'] = nullptr;
-    m_neighbour['E'] = nullptr;
-    m_neighbour['W'] = nullptr;
-
-    m_neighbourIndexList.clear();
-    m_particles.clear();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-Cell::Cell(const size_t _index, const vec2 _minUV, const vec2 _maxUV, const std::array<magnitude_ptr,7>& _magnitude,const std::array<cell_ptr,4>& _neighbour)
+Cell::Cell(Grid* _grid, const size_t _index)
 {
-    setLabel(Label::EMPTY);
-    setStatus(Status::INACTIVE);
+    m_grid = _grid;
     m_index = _index;
-
-    m_minU = _minUV.m_x;
-    m_minV = _minUV.m_y;
-    m_maxU = _maxUV.m_x;
-    m_maxV = _maxUV.m_y;
-
-    m_deltaU = m_maxU - m_minU;
-    m_deltaV = m_maxV - m_minV;
-
-    m_centre.m_x = m_minU + m_deltaU/2;
-    m_centre.m_y = m_minV + m_deltaV/2;
-
-    m_halfEdge['N'] = vec2(m_centre.m_x,m_maxV);
-    m_halfEdge['S'] = vec2(m_centre.m_x,m_minV);
-    m_halfEdge['E'] = vec2(m_maxU,m_centre.m_y);
-    m_halfEdge['W'] = vec2(m_minU,m_centre.m_y);
-
-    m_particlePoolSize = 0;
-    m_particleCount = 0;
-
-    m_initialVelocityU = _magnitude[0];
-    m_velocityU = _magnitude[1];
-    m_deltaVelocityU = _magnitude[2];
-    m_initialVelocityV = _magnitude[3];
-    m_velocityV = _magnitude[4];
-    m_deltaVelocityV = _magnitude[5];
-    m_pressure = _magnitude[6];
-
-    m_neighbour['N'] = _neighbour[0];
-    m_neighbour['S'] = _neighbour[1];
-    m_neighbour['E'] = _neighbour[2];
-    m_neighbour['W'] = _neighbour[3];
-
-    m_neighbourIndexList.clear();
-    m_particles.clear();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 Cell::Cell(const Cell& _other)
 {
-    this->m_label = _other.m_label;
-    this->m_status = _other.m_status;
+    this->m_grid = _other.m_grid;
     this->m_index = _other.m_index;
+}
 
-    this->m_minU = _other.m_minU;
-    this->m_minV = _other.m_minV;
-    this->m_maxU = _other.m_maxU;
-    this->m_maxV = _other.m_maxV;
+//----------------------------------------------------------------------------------------------------------------------
+Cell& Cell::operator=(const Cell& _other)
+{
+    assert(this != &_other);
 
-    this->m_deltaU = _other.m_deltaU;
-    this->m_deltaV = _other.m_deltaU;
+    this->m_grid = _other.m_grid;
+    this->m_index = _other.m_index;
 
-    this->m_centre = _other.m_centre;
+    return *this;
+}
+//----------------------------------------------------------------------------------------------------------------------
+Cell::~Cell(){}
 
-    this->m_halfEdge = _other.m_halfEdge;
+//----------------------------------------------------------------------------------------------------------------------
+Label Cell::label() const
+{
+    return m_grid->m_gridLabel[m_index];
+}
 
-    this->m_particlePoolSize = _other.m_particlePoolSize;
-    this->m_particleCount = _other.m_particleCount;
+//----------------------------------------------------------------------------------------------------------------------
+Status Cell::status() const
+{
+    return m_grid->m_gridStatus[m_index];
+}
 
-    this->m_initialVelocityU = _other.m_initialVelocityU;
-    this->m_velocityU =  _other.m_velocityU;
-    this->m_deltaVelocityU = _other.m_deltaVelocityU;
-    this->m_initialVelocityV = _other.m_initialVelocityV;
-    this->m_velocityV = _other.m_velocityV;
-    this->m_deltaVelocityV = _other.m_deltaVelocityV;
-    this->m_pressure = _other.m_pressure;
+//----------------------------------------------------------------------------------------------------------------------
+size_t Cell::column() const
+{
+    return m_index%m_grid->m_nColumns;
+}
 
-    this->m_neighbour = _other.m_neighbour;
-    this->m_neighbourIndexList = _other.m_neighbourIndexList;
-    this->m_particles = _other.m_particles;
+//----------------------------------------------------------------------------------------------------------------------
+size_t Cell::row() const
+{
+    return m_index/m_grid->m_nColumns;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-Cell& Cell::operator=(const Cell& _other)
+float Cell::deltaU() const
 {
-    assert(this != &_other);
+    return maxU() - minU();
+}
 
-    this->m_label = _other.m_label;
-    this->m_status = _other.m_status;
-    this->m_index = _other.m_index;
+//----------------------------------------------------------------------------------------------------------------------
+float Cell::deltaV() const
+{
+    return maxV() - minV();
+}
 
-    this->m_minU = _other.m_minU;
-    this->m_minV = _other.m_minV;
-    this->m_maxU = _other.m_maxU;
-    this->m_maxV = _other.m_maxV;
+//----------------------------------------------------------------------------------------------------------------------
+float Cell::minU() const
+{
+    return m_grid->m_gridpointU[column()];
+}
 
-    this->m_deltaU = _other.m_deltaU;
-    this->m_deltaV = _other.m_deltaU;
+//----------------------------------------------------------------------------------------------------------------------
+float Cell::minV() const
+{
+    return m_grid->m_gridpointV[row()];
+}
 
-    this->m_centre = _other.m_centre;
+//----------------------------------------------------------------------------------------------------------------------
+float Cell::maxU() const
+{
+    return m_grid->m_gridpointU[column()+1];
+}
 
-    this->m_halfEdge = _other.m_halfEdge;
+//----------------------------------------------------------------------------------------------------------------------
+float Cell::maxV() const
+{
+    return m_grid->m_gridpointV[row()+1];
+}
 
-    this->m_particlePoolSize = _other.m_particlePoolSize;
-    this->m_particleCount = _other.m_particleCount;
+//----------------------------------------------------------------------------------------------------------------------
+Cell::vec2 Cell::centre() const
+{
+    return vec2(minU() + deltaU()/2, minV() + deltaV()/2);
+}
 
-    this->m_initialVelocityU = _other.m_initialVelocityU;
-    this->m_velocityU =  _other.m_velocityU;
-    this->m_deltaVelocityU = _other.m_deltaVelocityU;
-    this->m_initialVelocityV = _other.m_initialVelocityV;
-    this->m_velocityV = _other.m_velocityV;
-    this->m_deltaVelocityV = _other.m_deltaVelocityV;
-    this->m_pressure = _other.m_pressure;
+//----------------------------------------------------------------------------------------------------------------------
+//returns the middle point of the edge N,S,E or W
+Cell::vec2 Cell::halfEdge(char _key) const
+{
+    vec2 c = centre();
+    switch(_key)
+    {
+        case 'N': return vec2(c.m_x,maxV());
+        case 'S': return vec2(c.m_x,minV());
+        case 'E': return vec2(maxU(),c.m_y);
+        case 'W': return vec2(minU(),c.m_y);
+        default: throw(std::invalid_argument("Error: Unknown half edge"));
+    }
+}
 
-    this->m_neighbour = _other.m_neighbour;
-    this->m_neighbourIndexList = _other.m_neighbourIndexList;
-    this->m_particles = _other.m_particles;
+//----------------------------------------------------------------------------------------------------------------------
+size_t Cell::particleCount() const
+{
+    return m_grid->m_particleCount[m_index];
+}
 
-    return *this;
+//----------------------------------------------------------------------------------------------------------------------
+//returns the index of the neighbours N,S,E,W, -1 if the neighbour is outside the grid
+std::array<int,4> Cell::neighbours() const
+{
+    std::array<int,4> result = {{neighbour('N'),neighbour('S'),neighbour('E'),neighbour('W')}};
+    return result;
 }
+
 //----------------------------------------------------------------------------------------------------------------------
-Cell::~Cell(){}
+int Cell::neighbour(char _key) const
+{
+    size_t x = column();
+    size_t y = row();
+    switch(_key)
+    {
+        case 'N': return y+1 < m_grid->m_nRows ? static_cast<int>(m_index+m_grid->m_nColumns) : -1;
+        case 'S': return y >= 1 ? static_cast<int>(m_index-m_grid->m_nColumns) : -1;
+        case 'E': return x+1 < m_grid->m_nColumns ? static_cast<int>(m_index+1) : -1;
+        case 'W': return x >= 1 ? static_cast<int>(m_index-1) : -1;
+        default: throw(std::invalid_argument("Error: Unknown neighbour"));
+    }
+}
 
 //----------------------------------------------------------------------------------------------------------------------
-float Cell::density()
+float Cell::density() const
 {
-    return static_cast<float>(m_particleCount)
-            /static_cast<float>(m_particlePoolSize);
+    return static_cast<float>(particleCount())
+            /static_cast<float>(m_grid->m_particlePoolSize);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-float Cell::velocityU()
+float Cell::velocityU() const
 {
-    return *m_velocityU;
+    return m_grid->m_gridVelocityU[m_index];
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-float Cell::velocityV()
+float Cell::velocityV() const
 {
-    return *m_velocityV;
+    return m_grid->m_gridVelocityV[m_index];
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-float Cell::deltaVelocityU()
+float Cell::deltaVelocityU() const
 {
-    return *m_deltaVelocityU;
+    return m_grid->m_gridDeltaVelocityU[m_index];
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-float Cell::deltaVelocityV()
+float Cell::deltaVelocityV() const
 {
-    return *m_deltaVelocityV;
+    return m_grid->m_gridDeltaVelocityV[m_index];
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-float Cell::initialVelocityU()
+float Cell::initialVelocityU() const
 {
-    return *m_initialVelocityU;
+    return m_grid->m_gridInitialVelocityU[m_index];
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-float Cell::initialVelocityV()
+float Cell::initialVelocityV() const
 {
-    return *m_initialVelocityV;
+    return m_grid->m_gridInitialVelocityV[m_index];
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 //Calculate the interpolated value of the velocity at the point specified
-Cell::vec2 Cell::velocity(const vec2 _point)
+Cell::vec2 Cell::velocity(const vec2 _point) const
 {
-    if ((_point.m_x<minU())||(_point.m_x>m_maxU))
+    if ((_point.m_x<minU())||(_point.m_x>maxU()))
         throw(std::range_error("Error: Point outside cell boundaries"));
-    if ((_point.m_y<minV())||(_point.m_y>m_maxV))
+    if ((_point.m_y<minV())||(_point.m_y>maxV()))
         throw(std::range_error("Error: Point outside cell boundaries"));
 
-    float alphaU = (_point.m_x-m_minU)/m_deltaU;
-    float alphaV = (_point.m_y-m_minV)/m_deltaV;
+    float alphaU = (_point.m_x-minU())/deltaU();
+    float alphaV = (_point.m_y-minV())/deltaV();
 
     //the cell neighbours
-    float E_velocityU = m_neighbour['E'] == nullptr ? 0.0f: m_neighbour['E']->velocityU();
-    float N_velocityV = m_neighbour['N'] == nullptr ? 0.0f: m_neighbour['N']->velocityV();
+    int E = neighbour('E');
+    int N = neighbour('N');
+    float E_velocityU = E < 0 ? 0.0f: m_grid->m_gridVelocityU[E];
+    float N_velocityV = N < 0 ? 0.0f: m_grid->m_gridVelocityV[N];
     vec2 result;
 
     //calculate the interpolated value of the velocity
     result.m_x = (1-alphaU)*velocityU() + alphaU*E_velocityU;
-    result.m_y= (1-alphaV)*velocityV() + alphaU*N_velocityV;
+    result.m_y= (1-alphaV)*velocityV() + alphaV*N_velocityV;
 
     return result;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 //Calculate the interpolated value of delta velocity at the point specified
-Cell::vec2 Cell::deltaVelocity(const vec2 _point)
+Cell::vec2 Cell::deltaVelocity(const vec2 _point) const
 {
-    if ((_point.m_x<minU())||(_point.m_x>m_maxU))
+    if ((_point.m_x<minU())||(_point.m_x>maxU()))
         throw(std::range_error("Error: Point outside cell boundaries"));
-    if ((_point.m_y<minV())||(_point.m_y>m_maxV))
+    if ((_point.m_y<minV())||(_point.m_y>maxV()))
         throw(std::range_error("Error: Point outside cell boundaries"));
 
-    float alphaU = (_point.m_x-m_minU)/m_deltaU;
-    float alphaV = (_point.m_y-m_minV)/m_deltaV;
+    float alphaU = (_point.m_x-minU())/deltaU();
+    float alphaV = (_point.m_y-minV())/deltaV();
 
     //the cell neighbours
-    float E_deltaVelocityU = m_neighbour['E'] == nullptr ? 0.0f: m_neighbour['E']->deltaVelocityU();
-    float N_deltaVelocityV = m_neighbour['N'] == nullptr ? 0.0f: m_neighbour['N']->deltaVelocityV();
+    int E = neighbour('E');
+    int N = neighbour('N');
+    float E_deltaVelocityU = E < 0 ? 0.0f: m_grid->m_gridDeltaVelocityU[E];
+    float N_deltaVelocityV = N < 0 ? 0.0f: m_grid->m_gridDeltaVelocityV[N];
     vec2 result;
 
     //calculate the interpolated value of the velocity
     result.m_x = (1-alphaU)*deltaVelocityU() + alphaU*E_deltaVelocityU;
-    result.m_y= (1-alphaV)*deltaVelocityV() + alphaU*N_deltaVelocityV;
+    result.m_y= (1-alphaV)*deltaVelocityV() + alphaV*N_deltaVelocityV;
 
     return result;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 //calculate the velocity divergence at this cell
-float Cell::divergence()
+float Cell::divergence() const
 {
-    float E_velocityU = m_neighbour['E'] == nullptr ? 0.0f: m_neighbour['E']->velocityU();
-    float N_velocityV = m_neighbour['N'] == nullptr ? 0.0f: m_neighbour['N']->velocityV();
+    int E = neighbour('E');
+    int N = neighbour('N');
+    float E_velocityU = E < 0 ? 0.0f: m_grid->m_gridVelocityU[E];
+    float N_velocityV = N < 0 ? 0.0f: m_grid->m_gridVelocityV[N];
 
     float uDivergence = E_velocityU-velocityU();
     float vDivergence = N_velocityV-velocityV();
@@ -272,63 +262,53 @@ float Cell::divergence()
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-float Cell::pressure()
+float Cell::pressure() const
 {
-    return *m_pressure;
+    return m_grid->m_gridPressure[m_index];
 }
 
 //set methods
 //----------------------------------------------------------------------------------------------------------------------
 void Cell::setLabel(const Label _label)
 {
-    m_label = _label;
+    m_grid->m_gridLabel[m_index] = _label;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 void Cell::setStatus(const Status _status)
 {
-    m_status = _status;
+    m_grid->m_gridStatus[m_index] = _status;
 }
 
 
 //----------------------------------------------------------------------------------------------------------------------
 void Cell::setInitialVelocityU(const float _magnitude)
 {
-    *m_initialVelocityU = _magnitude;
+    m_grid->m_gridInitialVelocityU[m_index] = _magnitude;
     setVelocityU(_magnitude);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 void Cell::setVelocityU(const float _magnitude)
 {
-    *m_velocityU = _magnitude;
+    m_grid->m_gridVelocityU[m_index] = _magnitude;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 void Cell::setInitialVelocityV(const float _magnitude)
 {
-    *m_initialVelocityV = _magnitude;
+    m_grid->m_gridInitialVelocityV[m_index] = _magnitude;
     setVelocityV(_magnitude);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 void Cell::setVelocityV(const float _magnitude)
 {
-    *m_velocityV = _magnitude;
+    m_grid->m_gridVelocityV[m_index] = _magnitude;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 void Cell::setPressure(const float _magnitude)
 {
-    *m_pressure = _magnitude;
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-void Cell::initNeighbourIndexList()
-{
-    m_neighbourIndexList.resize(4);
-    m_neighbourIndexList[0] = m_neighbour['N'] == nullptr ? -1: m_neighbour['N']->index();
-    m_neighbourIndexList[1] = m_neighbour['S'] == nullptr ? -1: m_neighbour['S']->index();
-    m_neighbourIndexList[2] = m_neighbour['E'] == nullptr ? -1: m_neighbour['E']->index();
-    m_neighbourIndexList[3] = m_neighbour['W'] == nullptr ? -1: m_neighbour['W']->index();
+    m_grid->m_gridPressure[m_index] = _magnitude;
 }
@@ -3,6 +3,8 @@
 #include <cmath>
 #include <random>
 #include <iostream>
+#include <chrono>
+#include <limits>
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @file cell.cpp
@@ -25,15 +27,8 @@ FluidSimulator::FluidSimulator()
     //uncomment to emit 5 particles per cell
     //emitParticlesPerCell(5,0,1.0f);
 
-    size_t nParticles = m_particlePool.size();
-
-    //tells the cell how many particles have been initialised
-    Grid::iterator cell_it = m_grid.begin();
-    while(cell_it!=m_grid.end())
-    {
-        cell_it->setParticlePoolSize(nParticles);
-        cell_it++;
-    }
+    //tells the grid how many particles have been initialised
+    m_grid.setParticlePoolSize(m_particlePool.size());
 
     markCells();
 
@@ -166,44 +161,88 @@ void FluidSimulator::emitParticles(size_t _count,size_t _seed,float _velocity)
 }
 
 //----------------------------------------------------------------------------------------------------------------------
+//the full quality frame is the budgeted one with a budget it can never overrun
 void FluidSimulator::advanceFrame()
 {
+    advanceFrame(std::numeric_limits<double>::infinity(),false);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//the scheduler splits the frame in CFL substeps, within the substep budget. The quality is degraded one knob at a time
+//when the frame is about to overrun _budget
+FrameBudgetReport FluidSimulator::advanceFrame(double _budget, bool _playing)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+
+    FrameBudgetReport report;
+    report.m_budget = _budget;
+
     float frameTime = 1.0f/30.0f; // 30Hz
-    float CFLCoefficient = m_cfl; //TODO
-    while(!m_frameReady)
-    {
-        if(frameTime <= 0.0f)
-        {
-            m_frameReady = true;
-            break;
-        }
+    float cellSize = std::min(m_grid.deltaU(),m_grid.deltaV());
 
-        float simulationTimeStep = 0.0f;
-        if(m_grid.maxVelocity()==0)
-        {
-            simulationTimeStep = frameTime;
-        }
-        else
-        {
-            simulationTimeStep = CFLCoefficient/m_grid.maxVelocity();
-        }
+    //settings restored at the end of the frame
+    float cfl = m_substepScheduler.cfl();
+    size_t maxSubsteps = m_substepScheduler.maxSubsteps();
 
-        if(simulationTimeStep > frameTime)
+    size_t level = 0;
+    double elapsed = 0.0;
+    m_substepScheduler.beginFrame(frameTime);
+    while(!m_substepScheduler.frameDone())
+    {
+        //cost of the substeps left, from the average substep of this frame
+        size_t substeps = m_substepScheduler.record().m_substeps;
+        if(substeps > 0 && level < 3)
         {
-            simulationTimeStep=frameTime;
+            double substepTime = elapsed/substeps;
+            size_t substepsLeft = m_substepScheduler.substepsLeft(m_grid.maxVelocity(),cellSize);
+            if(elapsed + substepTime*substepsLeft > _budget)
+            {
+                ++level;
+                if(level == 1)
+                {
+                    m_substepScheduler.setCFL(cfl*m_budgetCFLScale);
+                    report.m_largerCFL = true;
+                }
+                else if(level == 2 && m_pressureSolverMode)
+                {
+                    pressureSolver().setTolerance(std::max(m_pressureTolerance,m_budgetPressureTolerance));
+                    report.m_looserPressure = true;
+                }
+                else
+                {
+                    //at least one substep, to finish the frame
+                    double affordable = std::max(0.0,(_budget-elapsed)/substepTime);
+                    m_substepScheduler.setMaxSubsteps(substeps+std::max<size_t>(1,static_cast<size_t>(affordable)));
+                    report.m_cappedSubsteps = true;
+                    level = 3;
+                }
+            }
         }
 
         //Lower velocities require less iterations
-        routineFLIP(simulationTimeStep);
-        frameTime -= simulationTimeStep;
+        routineFLIP(m_substepScheduler.nextStep(m_grid.maxVelocity(),cellSize));
+        elapsed = std::chrono::duration<double,std::milli>(clock::now()-start).count();
     }
-    m_frameReady = false;
+    m_substepScheduler.endFrame();
+
+    m_substepScheduler.setCFL(cfl);
+    m_substepScheduler.setMaxSubsteps(maxSubsteps);
+    if(report.m_looserPressure)
+        pressureSolver().setTolerance(m_pressureTolerance);
+
+    report.m_time = elapsed;
+    report.m_substeps = m_substepScheduler.record().m_substeps;
+    report.m_overrun = elapsed > _budget;
+    report.m_skipVisualisation = _playing && (report.m_cappedSubsteps || report.m_overrun);
+    return report;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 //------------------------MAIN FLIP ROUTINE-----------------------------------------------------------------------------
 void FluidSimulator::routineFLIP(float _timeStep)
 {
+    ++m_substep;
 
     //transfer particle initial velocities to the grid and store the values on the grid.
     transferToGrid();
@@ -214,15 +253,13 @@ void FluidSimulator::routineFLIP(float _timeStep)
         pressureSolve(_timeStep);
     }
 
-    //calculated the change as deltaVelocity = initialVelocity - updatedVelocity
-    m_grid.deltaVelocityUpdate();
+    //calculated the change as deltaVelocity = updatedVelocity - initialVelocity, and updates the maximum velocity
+    //in the system and the velocity statistics in the same pass
+    m_grid.velocityUpdate(parallelChunks(m_grid.size()/m_cellGrainSize,m_threadCount));
 
     //advect the particles in the grid velocity field
     advectParticles(_timeStep);
 
-    //Updates th maximum velocity in the system
-    m_grid.maxVelocityUpdate();
-
     //tracks the active cells
     markCells();
 }
@@ -230,42 +267,162 @@ void FluidSimulator::routineFLIP(float _timeStep)
 //----------------------------------------------------------------------------------------------------------------------
 //Implements the transfer of velocity from particles to the grid
 //It sums at each grid point the particles values modualted by a kernel function that gives
-//the weights of the nearby particles
+//the weights of the nearby particles.
+//The particles are still sorted per cell by the markCells of the previous substep, so the transfer walks the cell
+//buckets and reuses the cell index found by the fused pass of advectParticles
 void FluidSimulator::transferToGrid()
 {
 
     //Weight = totNumberOfParticles/ nonBoundaryCells
     float W = m_particlePool.size()/static_cast<float>(m_simulationSize);
-    float k_temp = 0.0f;
-
-    float temp_initialVelocity;
 
     //reset initial velocity U,V to 0.0f
     m_grid.resetInitialVelocity();
 
-    Grid::iterator cell_it;
-    for(auto &p: m_particlePool)
+    //every thread zeroes and sums back two buffers as large as the grid, so small pools are transferred serially
+    if(parallelChunks(m_particlePool.size()/m_particleGrainSize,m_threadCount)>1)
     {
-        cell_it = m_grid.begin();
-        while(cell_it != m_grid.end())
+        transferToGridParallel(W);
+    }
+    else
+    {
+        scatterCells(0,m_grid.size(),W,m_grid.initialVelocityU(),m_grid.initialVelocityV());
+    }
+
+    //the updated velocity starts from the transferred values
+    m_grid.applyInitialVelocity();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//Parallel version of the transfer to the grid.
+//Each thread scatters the cells holding a slice of the particle pool in its own U,V buffers, shaped as the grid.
+//The buffers are then summed, in thread order, on disjoint slices of the grid.
+void FluidSimulator::transferToGridParallel(float _weight)
+{
+    size_t nChunks = parallelChunks(m_particlePool.size()/m_particleGrainSize,m_threadCount);
+    size_t size = m_grid.size();
+
+    m_transferBufferU.resize(nChunks);
+    m_transferBufferV.resize(nChunks);
+
+    //scatter. A cell goes to the chunk holding its first particle
+    const size_t* offset = m_grid.particleOffsets();
+    parallelFor(m_particlePool.size(),nChunks,[this,_weight,size,offset](size_t _begin, size_t _end, size_t _chunk)
+    {
+        std::vector<float>& bufferU = m_transferBufferU[_chunk];
+        std::vector<float>& bufferV = m_transferBufferV[_chunk];
+        bufferU.assign(size,0.0f);
+        bufferV.assign(size,0.0f);
+
+        size_t cellBegin = std::lower_bound(offset,offset+size,_begin)-offset;
+        size_t cellEnd = std::lower_bound(offset,offset+size,_end)-offset;
+        scatterCells(cellBegin,cellEnd,_weight,bufferU.data(),bufferV.data());
+    });
+
+    //reduction
+    float* initialVelocityU = m_grid.initialVelocityU();
+    float* initialVelocityV = m_grid.initialVelocityV();
+    parallelFor(size,nChunks,[this,nChunks,initialVelocityU,initialVelocityV](size_t _begin, size_t _end, size_t)
+    {
+        for(size_t chunk = 0; chunk<nChunks; ++chunk)
         {
-            //take only the values of nearby particles
-            k_temp = kernel(p.m_position-cell_it->halfEdge('W'));
-            temp_initialVelocity = cell_it->initialVelocityU();
-            temp_initialVelocity += p.m_velocity.m_x*(k_temp/W);
+            const float* bufferU = m_transferBufferU[chunk].data();
+            const float* bufferV = m_transferBufferV[chunk].data();
+            for(size_t i = _begin; i<_end; ++i)
+            {
+                initialVelocityU[i] += bufferU[i];
+                initialVelocityV[i] += bufferV[i];
+            }
+        }
+    });
+}
 
-            //stores the particle initial velocity in the U direction
-            cell_it->setInitialVelocityU(temp_initialVelocity);
+//----------------------------------------------------------------------------------------------------------------------
+//Adds the velocity of the particles of the cells [_begin,_end), weighted by the kernel, to the U and V faces indexed
+//as the cells. The hat kernel has a support of one cell in each direction, so the particles of cell (x,y) can only
+//reach the U faces of columns x..x+1 and rows y-1..y+1, and the V faces of columns x-1..x+1 and rows y..y+1.
+//The particles of a cell are summed in these two tiles, which are added to the faces once per cell.
+//The kernel is separable, the weight of a face is the product of the hat of its column and of its row
+void FluidSimulator::scatterCells(size_t _begin, size_t _end, float _weight, float* _u, float* _v)
+{
+    float deltaU = m_grid.deltaU();
+    float deltaV = m_grid.deltaV();
+    int nColumns = static_cast<int>(m_grid.nColumns());
+    int nRows = static_cast<int>(m_grid.nRows());
+
+    const float* positionX = m_particlePool.positionX();
+    const float* positionY = m_particlePool.positionY();
+    const float* velocityX = m_particlePool.velocityX();
+    const float* velocityY = m_particlePool.velocityY();
+
+    float tileU[3][2];
+    float tileV[2][3];
+    float columnU[2];
+    float rowU[3];
+    float columnV[3];
+    float rowV[2];
+    for(size_t cell = _begin; cell<_end; ++cell)
+    {
+        size_t begin = m_grid.particleOffset(cell);
+        size_t end = begin + m_grid.particleCount(cell);
+        if(begin == end)
+            continue;
 
-            //take only the values of nearby particles
-            k_temp = kernel(p.m_position-cell_it->halfEdge('S'));
-            temp_initialVelocity = cell_it->initialVelocityV();
-            temp_initialVelocity += p.m_velocity.m_y*(k_temp/W);
+        int cellX = static_cast<int>(cell%nColumns);
+        int cellY = static_cast<int>(cell/nColumns);
+        std::fill(&tileU[0][0],&tileU[0][0]+6,0.0f);
+        std::fill(&tileV[0][0],&tileV[0][0]+6,0.0f);
 
-            //stores the particle initial velocity in the U direction
-            cell_it->setInitialVelocityV(temp_initialVelocity);
+        for(size_t i = begin; i<end; ++i)
+        {
+            //U faces are located at (x*deltaU, (y+0.5)*deltaV), V faces at ((x+0.5)*deltaU, y*deltaV)
+            for(int k = 0; k<2; ++k)
+            {
+                columnU[k] = h((positionX[i]-(cellX+k)*deltaU)/deltaU);
+                rowV[k] = h((positionY[i]-(cellY+k)*deltaV)/deltaV);
+            }
+            for(int k = 0; k<3; ++k)
+            {
+                rowU[k] = h((positionY[i]-(cellY+k-0.5f)*deltaV)/deltaV);
+                columnV[k] = h((positionX[i]-(cellX+k-0.5f)*deltaU)/deltaU);
+            }
 
-            cell_it++;
+            for(int y = 0; y<3; ++y)
+            {
+                for(int x = 0; x<2; ++x)
+                {
+                    tileU[y][x] += velocityX[i]*((columnU[x]*rowU[y])/_weight);
+                }
+            }
+            for(int y = 0; y<2; ++y)
+            {
+                for(int x = 0; x<3; ++x)
+                {
+                    tileV[y][x] += velocityY[i]*((columnV[x]*rowV[y])/_weight);
+                }
+            }
+        }
+
+        //faces outside the grid are dropped
+        for(int y = 0; y<3; ++y)
+        {
+            for(int x = 0; x<2; ++x)
+            {
+                int faceX = cellX+x;
+                int faceY = cellY+y-1;
+                if(faceX<nColumns && faceY>=0 && faceY<nRows)
+                    _u[faceY*nColumns+faceX] += tileU[y][x];
+            }
+        }
+        for(int y = 0; y<2; ++y)
+        {
+            for(int x = 0; x<3; ++x)
+            {
+                int faceX = cellX+x-1;
+                int faceY = cellY+y;
+                if(faceX>=0 && faceX<nColumns && faceY<nRows)
+                    _v[faceY*nColumns+faceX] += tileV[y][x];
+            }
         }
     }
 }
@@ -292,14 +449,99 @@ float FluidSimulator::h(float _r)
 //----------------------------------------------------------------------------------------------------------------------
 void FluidSimulator::advectParticles(float _timeStep)
 {
-    //Forward Euler Advection
-    for(auto &p : m_particlePool)
+    size_t nParticles = m_particlePool.size();
+    size_t size = m_grid.size();
+    size_t nChunks = parallelChunks(nParticles/m_particleGrainSize,m_threadCount);
+
+    //the first chunk counts the particles per cell straight in the grid, the others in their own buffer
+    size_t* particleCount = m_grid.particleCounts();
+    std::fill(particleCount,particleCount+size,0);
+    m_particleCountBuffer.resize(nChunks);
+
+    //the particles are independent, every chunk gives the same result as the serial loop
+    parallelFor(nParticles,nChunks,[this,_timeStep,size,particleCount](size_t _begin, size_t _end, size_t _chunk)
+    {
+        size_t* count = particleCount;
+        if(_chunk > 0)
+        {
+            m_particleCountBuffer[_chunk].assign(size,0);
+            count = m_particleCountBuffer[_chunk].data();
+        }
+        advectParticles(_timeStep,_begin,_end,count);
+    });
+
+    //reduction of the counts, on disjoint slices of the grid
+    if(nChunks > 1)
     {
+        parallelFor(size,nChunks,[this,nChunks,particleCount](size_t _begin, size_t _end, size_t)
+        {
+            for(size_t chunk = 1; chunk<nChunks; ++chunk)
+            {
+                const size_t* count = m_particleCountBuffer[chunk].data();
+                for(size_t i = _begin; i<_end; ++i)
+                {
+                    particleCount[i] += count[i];
+                }
+            }
+        });
+    }
+
+    m_particlesIndexed = true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//Fused particle pass over [_begin,_end). Each block of particles is updated with the grid delta velocity, moved,
+//collided with the boundaries and assigned to its cell while it is in cache, so markCells only has to sort the pool.
+//The cell counts are added to _cellCount
+void FluidSimulator::advectParticles(float _timeStep, size_t _begin, size_t _end, size_t* _cellCount)
+{
+    const size_t blockSize = 256;
+    float sampleU[blockSize];
+    float sampleV[blockSize];
+
+    uint32_t* cellIndex = m_particlePool.cellIndex();
+
+    for(size_t block = _begin; block<_end; block+=blockSize)
+    {
+        size_t count = std::min(blockSize,_end-block);
+        float* positionX = m_particlePool.positionX()+block;
+        float* positionY = m_particlePool.positionY()+block;
+        float* velocityX = m_particlePool.velocityX()+block;
+        float* velocityY = m_particlePool.velocityY()+block;
+
         //interpolate the delta velocity from the grid and add to particle's velocity
-        p.m_velocity += m_grid.deltaVelocity(p.m_position);
+        m_grid.sampleDeltaVelocity(positionX,positionY,sampleU,sampleV,count);
+        for(size_t i = 0; i<count; ++i)
+        {
+            velocityX[i] += sampleU[i];
+            velocityY[i] += sampleV[i];
+        }
+
+        if(m_particleIntegrator != ParticleIntegrator::FORWARD_EULER)
+        {
+            //the Runge-Kutta integrators follow the grid velocity field
+            integrateParticles(m_particleIntegrator,m_grid,_timeStep,positionX,positionY,count);
+        }
+        else
+        {
+            //Forward Euler Advection
+            //Update particle position, in a separate loop over plain arrays so that it can be vectorised
+            for(size_t i = 0; i<count; ++i)
+            {
+                positionX[i] += _timeStep*velocityX[i];
+                positionY[i] += _timeStep*velocityY[i];
+            }
+        }
 
-        //Update particle position
-        p.m_position += _timeStep*p.m_velocity;
+        for(size_t i = 0; i<count; ++i)
+        {
+            //enforce boundary conditions
+            boundaryCollide(positionX[i],positionY[i],velocityX[i],velocityY[i]);
+
+            size_t cell = m_grid.cellIndex(vec2(positionX[i],positionY[i]));
+            cellIndex[block+i] = static_cast<uint32_t>(cell);
+            ++_cellCount[cell];
+        }
     }
 }
 
@@ -314,40 +556,79 @@ void FluidSimulator::markCells()
         {
             cell_it->setLabel(Label::EMPTY);
             cell_it->setStatus(Status::INACTIVE);
-            cell_it->resetParticleCount();
         }
         cell_it++;
     }
 
-    //marks the cells containing particles as FLUID and ACTIVE
-    Cell* c;
-    for(auto &p :m_particlePool)
+    //sorts the particles per cell, so that the particles of a cell are contiguous in the pool.
+    //The fused pass of advectParticles already enforced the boundary conditions and found the cell of each particle
+    if(m_particlesIndexed)
+    {
+        m_grid.sortIndexedParticles(m_particlePool);
+    }
+    else
     {
-        c = &(m_grid.cell(p.m_position));
-        if(c->label()==Label::EMPTY)
+        //enforce boundary conditions
+        float* positionX = m_particlePool.positionX();
+        float* positionY = m_particlePool.positionY();
+        float* velocityX = m_particlePool.velocityX();
+        float* velocityY = m_particlePool.velocityY();
+        for(size_t i = 0; i<m_particlePool.size(); ++i)
         {
-            c->setLabel(Label::FLUID);
-            c->setStatus(Status::ACTIVE);
-            c->incrementParticleCount();
+            boundaryCollide(positionX[i],positionY[i],velocityX[i],velocityY[i]);
         }
-        else
+        m_grid.sortParticles(m_particlePool);
+    }
+    m_particlesIndexed = false;
+
+    //marks the cells containing particles as FLUID and ACTIVE
+    for(size_t i = 0; i<m_grid.size(); ++i)
+    {
+        Cell& c = m_grid.cell(i);
+        if(m_grid.particleCount(i) > 0 && c.label()==Label::EMPTY)
         {
-            //enforce boundary conditions
-            boundaryCollide(&p);
+            c.setLabel(Label::FLUID);
+            c.setStatus(Status::ACTIVE);
         }
     }
+
+    //tracks the cells that changed label, so that the pressure solve only patches their rows
+    if(m_cellLabel.size() != m_grid.size())
+    {
+        m_cellLabel.resize(m_grid.size());
+        m_pressureRebuild = true;
+    }
+    for(size_t i = 0; i<m_grid.size(); ++i)
+    {
+        if(m_grid.label(i) == m_cellLabel[i])
+            continue;
+
+        m_cellLabel[i] = m_grid.label(i);
+        if(!m_pressureRebuild)
+            m_changedCells.push_back(i);
+    }
+
+    //patching each changed cell touches 5 stencils and the parents of the cell on every multigrid level, past
+    //m_pressureRebuildFraction of the grid a rebuild is cheaper
+    if(m_changedCells.size() > m_pressureRebuildFraction*m_grid.size())
+    {
+        m_pressureRebuild = true;
+    }
+    if(m_pressureRebuild)
+    {
+        m_changedCells.clear();
+    }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 //basic solid velocity at the boundaries.
-//If a particle travels outside the boundaries it is reprojected in the opposite normal direction
-void FluidSimulator::boundaryCollide(particle_ptr _p)
+//If a particle at (_x,_y) travels outside the boundaries it is reprojected in the opposite normal direction
+void FluidSimulator::boundaryCollide(float _x, float _y, float& _vx, float& _vy) const
 {
-    vec2 pos = _p->m_position;
-    if(pos.m_x<=1 || pos.m_x>=m_grid.width()-1)
-        _p->m_velocity.m_x *= -1;
-    if(pos.m_y<=1 || pos.m_y>=m_grid.height()-1)
-        _p->m_velocity.m_y *= -1;
+    if(_x<=1 || _x>=m_grid.width()-1)
+        _vx *= -1;
+    if(_y<=1 || _y>=m_grid.height()-1)
+        _vy *= -1;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -373,45 +654,100 @@ FluidSimulator::vec2 FluidSimulator::particleTrace(vec2 _pos, float _timeStep)
 //Velocity field advection
 void FluidSimulator::advectVelocity(float _timeStep)
 {
-    vec2 pos;
+    //the new velocities are written in the back buffers while the traces still read the current ones, so the cells
+    //are independent
+    float* backVelocityU = m_grid.backVelocityU();
+    float* backVelocityV = m_grid.backVelocityV();
+
+    if(m_velocityAdvection == VelocityAdvection::SEMI_LAGRANGIAN)
+    {
+        semiLagrangianAdvection(_timeStep,backVelocityU,backVelocityV);
+        m_grid.swapVelocity();
+        return;
+    }
+
+    //MacCormack (Selle et al.,2008). The semi-Lagrangian result is traced forward in time, back to the grid point,
+    //and half the difference with the current velocity is the error the step made
+    m_advectedVelocityU.resize(m_grid.size());
+    m_advectedVelocityV.resize(m_grid.size());
+    semiLagrangianAdvection(_timeStep,m_advectedVelocityU.data(),m_advectedVelocityV.data());
+
+    const float* velocityU = m_grid.velocityU();
+    const float* velocityV = m_grid.velocityV();
+    const float* advectedU = m_advectedVelocityU.data();
+    const float* advectedV = m_advectedVelocityV.data();
+    size_t nChunks = parallelChunks(m_grid.size()/m_cellGrainSize,m_threadCount);
+    parallelFor(m_grid.size(),nChunks,[&](size_t _begin, size_t _end, size_t)
+    {
+        vec2 edge;
+        vec2 pos;
+        vec2 min;
+        vec2 max;
+        float u;
+        float v;
+        float corrected;
+        for(size_t i = _begin; i<_end; ++i)
+        {
+            const Cell& c = m_grid.cell(i);
+
+            //U velocity. The limiter clamps the corrected value to the faces the semi-Lagrangian step interpolated,
+            //so the correction can not create new extrema
+            edge = c.halfEdge('W');
+            pos = particleTrace(edge,-_timeStep);
+            m_grid.sampleFaces(advectedU,advectedV,pos.m_x,pos.m_y,u,v);
+            corrected = advectedU[i] + 0.5f*(velocityU[i]-u);
+            pos = particleTrace(edge,_timeStep);
+            m_grid.faceRange(velocityU,velocityV,pos.m_x,pos.m_y,min,max);
+            backVelocityU[i] = std::min(std::max(corrected,min.m_x),max.m_x);
+
+            //V velocity
+            edge = c.halfEdge('S');
+            pos = particleTrace(edge,-_timeStep);
+            m_grid.sampleFaces(advectedU,advectedV,pos.m_x,pos.m_y,u,v);
+            corrected = advectedV[i] + 0.5f*(velocityV[i]-v);
+            pos = particleTrace(edge,_timeStep);
+            m_grid.faceRange(velocityU,velocityV,pos.m_x,pos.m_y,min,max);
+            backVelocityV[i] = std::min(std::max(corrected,min.m_y),max.m_y);
+        }
+    });
 
-    std::vector<float> tempVelocityU;
-    std::vector<float> tempVelocityV;
+    m_grid.swapVelocity();
+}
 
+//----------------------------------------------------------------------------------------------------------------------
+//writes in _u,_v the velocity found at the start of the trace back in time of each face
+void FluidSimulator::semiLagrangianAdvection(float _timeStep, float* _u, float* _v)
+{
     //set the new velocity values equal to the old value of the hypotetical particle
     //that happen to be at that grid point.
     //Uses particle trace to track the velocit value
-
-    //Initially it doesn't store the new velocity in the grid
-    Grid::iterator cell_it = m_grid.begin();
-    while(cell_it != m_grid.end())
+    size_t nChunks = parallelChunks(m_grid.size()/m_cellGrainSize,m_threadCount);
+    parallelFor(m_grid.size(),nChunks,[this,_timeStep,_u,_v](size_t _begin, size_t _end, size_t)
     {
-        //U velocity
-        pos = particleTrace(cell_it->halfEdge('W'),_timeStep);
-        tempVelocityU.push_back(m_grid.velocity(pos).m_x);
+        vec2 pos;
+        for(size_t i = _begin; i<_end; ++i)
+        {
+            const Cell& c = m_grid.cell(i);
 
-        //V velocity
-        pos = particleTrace(cell_it->halfEdge('S'),_timeStep);
-        tempVelocityV.push_back(m_grid.velocity(pos).m_y);
-        cell_it++;
-    }
+            //U velocity
+            pos = particleTrace(c.halfEdge('W'),_timeStep);
+            _u[i] = m_grid.velocity(pos).m_x;
 
-    //Then, new velocities are then stored in the grid
-    for(size_t i = 0; i<m_grid.size(); ++i)
-    {
-        m_grid.cell(i).setVelocityU(tempVelocityU[i]);
-        m_grid.cell(i).setVelocityV(tempVelocityV[i]);
-    }
+            //V velocity
+            pos = particleTrace(c.halfEdge('S'),_timeStep);
+            _v[i] = m_grid.velocity(pos).m_y;
+        }
+    });
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 //calculates the negative divergence which will become the right hand side of the linear sistem
-//used to solve for the pressure
+//used to solve for the pressure. It is indexed by the rows of the pressure operator, i.e. only the FLUID cells
 VectorXd FluidSimulator::negativeDivergence(float _timeStep)
 {
     size_t height = nColumns()-1;
     size_t width = nRows()-1;
-    size_t dim = m_grid.size();
+    size_t dim = static_cast<size_t>(m_pressureOperator.rows());
 
     VectorXd b(dim);
 
@@ -419,25 +755,21 @@ VectorXd FluidSimulator::negativeDivergence(float _timeStep)
     float scale = 1.0f/dx;
 
     vec2 coordinate;
-    for(size_t i = 0; i<m_grid.size();++i)
+    for(size_t i = 0; i<dim;++i)
     {
-        b(i) = 0.0f;
-        if(m_grid.cell(i).label() == Label::FLUID)
-        {
-            coordinate = m_grid.toCartesian(i);
-            //takes the velocity divergence at the specified position
-            b(i) = -scale*m_grid.velocityDivergence(coordinate.m_x,coordinate.m_y);
-        }
+        coordinate = m_grid.toCartesian(m_pressureOperator.cell(i));
+        //takes the velocity divergence at the specified position
+        b(i) = -scale*m_grid.velocityDivergence(coordinate.m_x,coordinate.m_y);
     }
 
     //modify the right hand side b to take into account the velocit at the boundaries
-    size_t index;
+    int index;
     for (size_t y = 0; y < height; ++y)
     {
         for (size_t x = 0; x < width; ++x)
         {
-            index = m_grid.toIndex(x,y);
-            if(m_grid.cell(x,y).label() == Label::FLUID)
+            index = m_pressureOperator.row(m_grid.toIndex(x,y));
+            if(index >= 0)
             {
                 //case the left cell is solid
                 if(x>=1 && m_grid.cell(x-1,y).label() == Label::SOLID)
@@ -472,88 +804,25 @@ VectorXd FluidSimulator::negativeDivergence(float _timeStep)
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-//setup matrix entries for the pressure equation
+//setup matrix entries for the pressure equation.
+//Assembled version of the matrix-free operator used by pressureSolve
 SparseMatrix<double,RowMajor> FluidSimulator::setUpMatrixA(float _timeStep)
 {
-
-    size_t height = nColumns()-1;
-    size_t width = nRows()-1;
-    size_t dim = m_grid.size();
-
-    //Step2. Set the entries of A
-    SparseMatrix<double,RowMajor> A(dim,dim);
-
-    float dx = m_grid.deltaU();
-    float scale;
-
-    for(size_t y=0;y<height;++y)
-    {
-        for(size_t x=0;x<width;++x)
-        {
-            scale = _timeStep/(m_grid.density(x,y)*dx*dx);
-            size_t i = y*width+x;//row index of A
-            size_t j = 0; //pressure equation coefficient index. Column index of A
-
-            if(m_grid.cell(x,y).label() == Label::FLUID)
-            {
-                //U
-                if(x>=1 && m_grid.cell(x-1,y).label() == Label::FLUID)
-                {
-                    //Adiag +=scale
-                    j=y*width+x;
-                    A.coeffRef(i,j) += scale;
-                }
-                if(x+1<width && m_grid.cell(x+1,y).label() == Label::FLUID)
-                {
-                    //Adiag +=scale
-                    j=y*width+x;
-                    A.coeffRef(i,j) += scale;
-                    //Ax = -scale
-                    j=(y+1)*width+x;
-                    A.coeffRef(i,j) = -scale;
-                }
-                else if(x+1<width && m_grid.cell(x+1,y).label() == Label::EMPTY)
-                {
-                    //Adiag +=scale
-                    j=y*width+x;
-                    A.coeffRef(i,j) += scale;
-                }
-                //V
-                if(y>=1 && m_grid.cell(x,y-1).label() == Label::FLUID)
-                {
-                    //Adiag +=scale
-                    j=y*width+x;
-                    A.coeffRef(i,j) += scale;
-                }
-                if(y+1<height && m_grid.cell(x,y+1).label() == Label::FLUID)
-                {
-                    //Adiag +=scale
-                    j=y*width+x;
-                    A.coeffRef(i,j) += scale;
-                    //Ay = -scale
-                    j=y*width+x+1;
-                    A.coeffRef(i,j) = -scale;
-                }
-                else if(y+1<height && m_grid.cell(x,y+1).label() == Label::EMPTY)
-                {
-                    //Adiag +=scale
-                    j=y*width+x;
-                    A.coeffRef(i,j) += scale;
-                }
-            }
-        }
-    }
-    return A;
-
+    PressureOperator A;
+    A.setUp(&m_grid,_timeStep);
+    return A.toSparseMatrix();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-//updates the grid pressure values
+//updates the grid pressure values, scattering the rows of the pressure operator back to their cells.
+//The non FLUID cells have zero pressure
 void FluidSimulator::updatePressureField(VectorXd _p)
 {
+    int row;
     for(size_t i= 0;i<m_grid.size(); i++)
     {
-        m_grid.pressure(i,_p(i));
+        row = m_pressureOperator.row(i);
+        m_grid.pressure(i,row >= 0 ? _p(row) : 0.0f);
     }
 }
 
@@ -652,31 +921,106 @@ float FluidSimulator::vsolid(size_t _x, size_t _y)
     return -m_grid.cell(_x,_y).velocityV();
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+void printPressureSolve(const PressureSolveRecord& _record)
+{
+    if(_record.m_stats.m_converged)
+        std::cout << "SUCCESS: Convergence, ";
+    else
+        std::cout << "FAILED: No Convergence, ";
+
+    std::cout << _record.m_solver << " iterations " << _record.m_stats.m_iterations;
+    if(_record.m_warmStart)
+        std::cout << ", saved by the warm start " << _record.m_iterationsSaved;
+    std::cout << ", error " << _record.m_stats.m_error << ", rows " << _record.m_size
+              << ", set up " << _record.m_setUpTime << " ms, solve " << _record.m_solveTime << " ms" << std::endl;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 //main pressure solve routine
 void FluidSimulator::pressureSolve(float _timeStep)
 {
-    size_t dim = m_grid.size();
+    typedef std::chrono::steady_clock clock;
+    clock::time_point setUpStart = clock::now();
 
-    //Step1. Negative Divergence
-    VectorXd b = negativeDivergence(_timeStep);
+    //Step1. Set up A. The operator is matrix-free, nothing is assembled. It numbers the FLUID cells, the only
+    //unknowns of the system, and only patches the stencil of the cells that changed label since the last solve
+    if(m_pressureRebuild)
+        m_pressureOperator.setUp(&m_grid,_timeStep);
+    else
+        m_pressureOperator.update(&m_grid,_timeStep,m_changedCells);
+    size_t dim = static_cast<size_t>(m_pressureOperator.rows());
 
-    //Step2. Set up the entries of A
-    SparseMatrix<double,RowMajor> A = setUpMatrixA(_timeStep);
+    //Step2. Negative Divergence
+    VectorXd b = negativeDivergence(_timeStep);
 
-    //Step3. Conjugate gradient
-    VectorXd p(dim);
-    ConjugateGradient<SparseMatrix<double,RowMajor>> cg;
-    cg.compute(A);
+    //the density scales the right hand side instead of the rows of A, so that A stays symmetric
+    for(size_t i = 0; i<dim; ++i)
+    {
+        b(i) *= m_grid.cell(m_pressureOperator.cell(i)).density();
+    }
 
-    //Step4. solve Ap=b
-    p = cg.solve(b);
-    if(cg.info() == Success)
-        std::cout<< "SUCCESS: Convergence" << std::endl;
+    //Step3-4. solve Ap=b
+    PressureSolver& solver = pressureSolver();
+    solver.setThreadCount(m_threadCount);
+    if(m_pressureRebuild)
+        solver.prepare(m_pressureOperator);
     else
+        solver.update(m_pressureOperator,m_changedCells);
+    m_changedCells.clear();
+    m_pressureRebuild = false;
+
+    //the warm start needs the labels of a previous solve on the same grid
+    bool warmStart = m_pressureWarmStart && m_pressureLabel.size() == m_grid.size() && m_pressureScale > 0.0;
+    VectorXd p = VectorXd::Zero(dim);
+    double initialResidual = 0.0;
+    if(warmStart)
+    {
+        //the guess is scaled by the factor minimising the error in the A-norm, so it is never worse than zero
+        p = pressureGuess(b);
+        VectorXd product = m_pressureOperator*p;
+        double energy = p.dot(product);
+        double alpha = energy > 0.0 ? p.dot(b)/energy : 0.0;
+        p *= alpha;
+        initialResidual = (b - alpha*product).norm();
+    }
+
+    clock::time_point solveStart = clock::now();
+    solver.solve(b,p,warmStart);
+    clock::time_point solveEnd = clock::now();
+
+    PressureSolveRecord& record = m_pressureRecord;
+    record.m_substep = m_substep;
+    record.m_solver = solver.name();
+    record.m_size = dim;
+    record.m_stats = solver.stats();
+    record.m_warmStart = warmStart;
+    record.m_setUpTime = std::chrono::duration<double,std::milli>(solveStart-setUpStart).count();
+    record.m_solveTime = std::chrono::duration<double,std::milli>(solveEnd-solveStart).count();
+
+    //a cold start begins with a residual of |b|. The iterations saved are the ones this solve would need to bring
+    //|b| down to the initial residual of the warm start, at the convergence rate it showed
+    record.m_iterationsSaved = 0;
+    double bNorm = b.norm();
+    size_t iterations = record.m_stats.m_iterations;
+    if(warmStart && bNorm > 0.0 && initialResidual > 0.0 && iterations > 0)
+    {
+        double finalResidual = record.m_stats.m_error*bNorm;
+        double rate = std::log(finalResidual/initialResidual)/iterations;
+        if(rate < 0.0)
+            record.m_iterationsSaved = std::lround(std::log(initialResidual/bNorm)/rate);
+    }
+
+    m_pressureHistory.push(record);
+    if(m_pressureSolveHandler)
+        m_pressureSolveHandler(record);
+
+    m_pressureLabel.resize(m_grid.size());
+    for(size_t i = 0; i<m_grid.size(); ++i)
     {
-        std::cout << "FAILED: No Convergence" << std::endl;
+        m_pressureLabel[i] = m_grid.label(i);
     }
+    m_pressureScale = m_pressureOperator.scale();
 
     //Step 5. Update Pressure Field
     updatePressureField(p);
@@ -688,6 +1032,94 @@ void FluidSimulator::pressureSolve(float _timeStep)
 
 
 
+//----------------------------------------------------------------------------------------------------------------------
+void FluidSimulator::setPressureSolverType(PressureSolverType _type)
+{
+    m_pressureSolverType = _type;
+    resetPressureSolver();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void FluidSimulator::setPressurePreconditioner(PressurePreconditioner _mode)
+{
+    m_pressurePreconditioner = _mode;
+    resetPressureSolver();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//the solver is created again on first use. It has to be prepared, it can not patch a preconditioner it never computed
+void FluidSimulator::resetPressureSolver()
+{
+    m_pressureSolver.reset();
+    m_pressureRebuild = true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+PressureSolver& FluidSimulator::pressureSolver()
+{
+    if(!m_pressureSolver)
+    {
+        m_pressureSolver = createPressureSolver(m_pressureSolverType,m_pressurePreconditioner);
+        m_pressureSolver->setTolerance(m_pressureTolerance);
+        m_pressureSolver->setRebuildFraction(m_pressureRebuildFraction);
+    }
+    return *m_pressureSolver;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void FluidSimulator::setPressureTolerance(double _tolerance)
+{
+    m_pressureTolerance = _tolerance;
+    if(m_pressureSolver)
+        m_pressureSolver->setTolerance(m_pressureTolerance);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void FluidSimulator::setPressureRebuildFraction(double _fraction)
+{
+    m_pressureRebuildFraction = _fraction;
+    if(m_pressureSolver)
+        m_pressureSolver->setRebuildFraction(m_pressureRebuildFraction);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//initial guess of the warm start: the pressure of the previous solve. A scales with the time step, so the previous
+//pressure is rescaled to the current time step. The cells that turned FLUID since then take the average pressure of
+//their neighbours that were FLUID, or zero as the free surface
+VectorXd FluidSimulator::pressureGuess(const VectorXd& _b)
+{
+    size_t dim = static_cast<size_t>(_b.size());
+    double rescale = m_pressureScale/m_pressureOperator.scale();
+    VectorXd guess(dim);
+
+    size_t cell;
+    for(size_t i = 0; i<dim; ++i)
+    {
+        cell = m_pressureOperator.cell(i);
+        if(m_pressureLabel[cell] == Label::FLUID)
+        {
+            guess(i) = rescale*m_grid.cell(cell).pressure();
+            continue;
+        }
+
+        double sum = 0.0;
+        size_t count = 0;
+        for(int n : m_grid.cell(cell).neighbours())
+        {
+            if(n>=0 && m_pressureLabel[n] == Label::FLUID)
+            {
+                sum += m_grid.cell(n).pressure();
+                ++count;
+            }
+        }
+        guess(i) = count > 0 ? rescale*sum/count : 0.0;
+    }
+
+    return guess;
+}
+
+
+
 /********************************VISUALIZATION DATA******************************************************/
 //Prepares the data for the view. This data represents the status of the simulator
 
@@ -741,15 +1173,16 @@ std::vector<FluidSimulator::vec3> FluidSimulator::activeCells(float _time)
 //----------------------------------------------------------------------------------------------------------------------
 std::vector<FluidSimulator::vec3> FluidSimulator::particles()
 {
-    std::vector<vec3> data;
-    vec3 pos;
-    pos.m_z = 0;
-    for(auto &p_pos: m_particlePool)
-    {
-        pos.m_x = p_pos.m_position.m_x;
-        pos.m_y = p_pos.m_position.m_y;
+    size_t nParticles = m_particlePool.size();
+    const float* positionX = m_particlePool.positionX();
+    const float* positionY = m_particlePool.positionY();
 
-        data.push_back(pos);
+    std::vector<vec3> data(nParticles);
+    for(size_t i = 0; i<nParticles; ++i)
+    {
+        data[i].m_x = positionX[i];
+        data[i].m_y = positionY[i];
+        data[i].m_z = 0.0f;
     }
     return data;
 }
@@ -1,4 +1,5 @@
 #include "grid.h"
+#include "parallel.h"
 
 #include <functional>
 #include <algorithm>
@@ -50,7 +51,7 @@ Grid::Grid(float _w,float _h,size_t _nColumns,size_t _nRows)
         }
     }
 
-    m_maxVelocity = 0.0f;
+    m_velocityStats = GridVelocityStats();
     initGrids();
 }
 
@@ -86,6 +87,8 @@ Grid::Grid(const Grid& _other)
             m_cellCentres.push_back(centre);
         }
     }
+
+    this->m_velocityStats = _other.m_velocityStats;
     initGrids();
 }
 
@@ -127,6 +130,7 @@ Grid& Grid::operator=(const Grid& _other)
         }
     }
 
+    this->m_velocityStats = _other.m_velocityStats;
     initGrids();
 
     return *this;
@@ -143,66 +147,35 @@ void Grid::initGrids()
     m_gridInitialVelocityU.resize(m_size,0.0f);
     m_gridVelocityU.resize(m_size,0.0f);
     m_gridDeltaVelocityU.resize(m_size,0.0f);
+    m_gridBackVelocityU.resize(m_size,0.0f);
 
     m_gridInitialVelocityV.resize(m_size,0.0f);
     m_gridVelocityV.resize(m_size,0.0f);
     m_gridDeltaVelocityV.resize(m_size,0.0f);
+    m_gridBackVelocityV.resize(m_size,0.0f);
 
     m_gridPressure.resize(m_size,0.0f);
 
-    m_gridCell.resize(m_size);
-
-    //initialize Cell grid and wire U,V,Pressure pointers to appropriate grids
-    size_t cell_index = 0;
-    vec2 minUV;
-    vec2 maxUV;
-    std::array<Grid::magnitude_ptr,7> magnitude;
-    std::array<Grid::cell_ptr,4> neighbours;
+    m_particleOffset.assign(m_size+1,0);
+    m_particleCount.assign(m_size,0);
 
-    for(size_t y = 1; y<m_gridpointV.size();++y)
-    {
-        for(size_t x = 1; x<m_gridpointU.size(); ++x)
-        {
-            cell_index = toIndex(x-1,y-1);
-            minUV.m_x = m_gridpointU.at(x-1);
-            minUV.m_y = m_gridpointV.at(y-1);
-            maxUV.m_x = m_gridpointU.at(x);
-            maxUV.m_y = m_gridpointV.at(y);
-
-            magnitude.at(0) = &(m_gridInitialVelocityU.at(cell_index));
-            magnitude.at(1) = &(m_gridVelocityU.at(cell_index));
-            magnitude.at(2) = &(m_gridDeltaVelocityU.at(cell_index));
-            magnitude.at(3) = &(m_gridInitialVelocityV.at(cell_index));
-            magnitude.at(4) = &(m_gridVelocityV.at(cell_index));
-            magnitude.at(5) = &(m_gridDeltaVelocityV.at(cell_index));
-            magnitude.at(6) = &(m_gridPressure.at(cell_index));
-
-            neighbours.at(0) =
-                    (y < m_height) ? &(m_gridCell.at(toIndex(x-1,y))) : nullptr;//N
-
-            neighbours.at(1) =
-                    (y >= 2) ? &(m_gridCell.at(toIndex(x-1,y-2))) : nullptr;//S
-
-            neighbours.at(2) =
-                    (x < m_width) ? &(m_gridCell.at(toIndex(x,y-1))) : nullptr;//E
-
-            neighbours.at(3) =
-                    (x >= 2) ? &(m_gridCell.at(toIndex(x-2,y-1))) : nullptr;//W
-
-            //the cell is initialised with the prepared data.
-            //The newly created cell will point to the appropriate velocity locations
-            //it also know its neighbours
-            m_gridCell.at(cell_index) = Cell(cell_index,minUV,maxUV,magnitude,neighbours);
-        }
-    }
+    m_gridLabel.assign(m_size,Label::EMPTY);
+    m_gridStatus.assign(m_size,Status::INACTIVE);
 
-    Grid::iterator cell_it = m_gridCell.begin();
-    while(cell_it!=m_gridCell.end())
+    //initialize the cells as views over the grid arrays
+    m_gridCell.resize(m_size);
+    for(size_t i = 0; i<m_size; ++i)
     {
-        cell_it->initNeighbourIndexList();
-        cell_it++;
+        m_gridCell[i] = Cell(this,i);
     }
+}
 
+//----------------------------------------------------------------------------------------------------------------------
+//the cells read the velocity through the grid arrays, so they see the new values without being touched
+void Grid::swapVelocity()
+{
+    m_gridVelocityU.swap(m_gridBackVelocityU);
+    m_gridVelocityV.swap(m_gridBackVelocityV);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -234,15 +207,16 @@ Grid::vec2 Grid::velocity(const vec2 _point)
     if ((_point.m_y<0)||(_point.m_y>m_height))
         return vec2(0.0f,0.0f);//throw(std::range_error("Error: Point outside grid boundaries"));
 
-    Cell c = cell(_point); //cell method
-    return c.velocity(_point);
+    vec2 result;
+    sampleFaces(m_gridVelocityU.data(),m_gridVelocityV.data(),_point.m_x,_point.m_y,result.m_x,result.m_y);
+    return result;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 //returns the velocity measured at the centre of the cell
 Grid::vec2 Grid::velocity(const size_t _x,const size_t _y)
 {
-    Cell c = m_gridCell[toIndex(_x,_y)];
+    Cell& c = m_gridCell[toIndex(_x,_y)];
     return c.velocity(c.centre());
 }
 
@@ -256,62 +230,272 @@ Grid::vec2 Grid::deltaVelocity(const vec2 _point)
     if ((_point.m_y<0)||(_point.m_y>m_height))
         return vec2(0.0f,0.0f);//throw(std::range_error("Error: Point outside grid boundaries"));
 
-    Cell c = cell(_point); //cell method
-    return c.deltaVelocity(_point);
+    vec2 result;
+    sampleFaces(m_gridDeltaVelocityU.data(),m_gridDeltaVelocityV.data(),_point.m_x,_point.m_y,result.m_x,result.m_y);
+    return result;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 //returns the delta velocity at the specified cell
 Grid::vec2 Grid::deltaVelocity(const size_t _x,const size_t _y)
 {
-    Cell c = m_gridCell[toIndex(_x,_y)];
+    Cell& c = m_gridCell[toIndex(_x,_y)];
     return c.deltaVelocity(c.centre());
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+//samples the velocity at _count points, given as separate x and y arrays, and writes the components in _u and _v
+void Grid::sampleVelocity(const float* _x, const float* _y, float* _u, float* _v, size_t _count) const
+{
+    const float* velocityU = m_gridVelocityU.data();
+    const float* velocityV = m_gridVelocityV.data();
+    for(size_t i = 0; i<_count; ++i)
+    {
+        sampleFaces(velocityU,velocityV,_x[i],_y[i],_u[i],_v[i]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//samples the delta velocity at _count points, given as separate x and y arrays, and writes the components in _u and _v
+void Grid::sampleDeltaVelocity(const float* _x, const float* _y, float* _u, float* _v, size_t _count) const
+{
+    const float* deltaVelocityU = m_gridDeltaVelocityU.data();
+    const float* deltaVelocityV = m_gridDeltaVelocityV.data();
+    for(size_t i = 0; i<_count; ++i)
+    {
+        sampleFaces(deltaVelocityU,deltaVelocityV,_x[i],_y[i],_u[i],_v[i]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//column and row of the cell containing the point, inside the grid, and interpolation weights of its E and N faces
+void Grid::sampleCell(float _x, float _y, size_t& _column, size_t& _row, float& _alphaU, float& _alphaV) const
+{
+    _column = static_cast<size_t>(_x/m_deltaU);
+    _row = static_cast<size_t>(_y/m_deltaV);
+    _column = _column < m_nColumns ? _column : m_nColumns-1;
+    _row = _row < m_nRows ? _row : m_nRows-1;
+
+    _alphaU = (_x-m_gridpointU[_column])/m_deltaU;
+    _alphaV = (_y-m_gridpointV[_row])/m_deltaV;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//interpolates the U,V face values at the point, with the same scheme of Cell::velocity:
+//U between the W and E faces of the cell, V between the S and N faces.
+//Faces outside the grid count as zero, points outside the grid give a zero result.
+void Grid::sampleFaces(const float* _faceU, const float* _faceV, float _x, float _y, float& _u, float& _v) const
+{
+    //Boundaries check
+    if((_x<0)||(_x>m_width)||(_y<0)||(_y>m_height))
+    {
+        _u = 0.0f;
+        _v = 0.0f;
+        return;
+    }
+
+    size_t column;
+    size_t row;
+    float alphaU;
+    float alphaV;
+    sampleCell(_x,_y,column,row,alphaU,alphaV);
+    size_t index = row*m_nColumns + column;
+
+    float E_faceU = (column+1)<m_nColumns ? _faceU[index+1] : 0.0f;
+    float N_faceV = (row+1)<m_nRows ? _faceV[index+m_nColumns] : 0.0f;
+
+    _u = (1-alphaU)*_faceU[index] + alphaU*E_faceU;
+    _v = (1-alphaV)*_faceV[index] + alphaV*N_faceV;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//minimum and maximum of the two faces sampleFaces interpolates for each component
+void Grid::faceRange(const float* _faceU, const float* _faceV, float _x, float _y, vec2& _min, vec2& _max) const
+{
+    if((_x<0)||(_x>m_width)||(_y<0)||(_y>m_height))
+    {
+        _min = vec2(0.0f,0.0f);
+        _max = vec2(0.0f,0.0f);
+        return;
+    }
+
+    size_t column;
+    size_t row;
+    float alphaU;
+    float alphaV;
+    sampleCell(_x,_y,column,row,alphaU,alphaV);
+    size_t index = row*m_nColumns + column;
+
+    float E_faceU = (column+1)<m_nColumns ? _faceU[index+1] : 0.0f;
+    float N_faceV = (row+1)<m_nRows ? _faceV[index+m_nColumns] : 0.0f;
+
+    _min.m_x = std::min(_faceU[index],E_faceU);
+    _max.m_x = std::max(_faceU[index],E_faceU);
+    _min.m_y = std::min(_faceV[index],N_faceV);
+    _max.m_y = std::max(_faceV[index],N_faceV);
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 //returns the velocity divergence at the specified cell
 float Grid::velocityDivergence(const size_t _x,const size_t _y)
 {
-    Cell c = m_gridCell[toIndex(_x,_y)];
-    return c.divergence();
+    return m_gridCell[toIndex(_x,_y)].divergence();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-//calculates the max velocity in the system
-void Grid::maxVelocityUpdate()
+//calculates the delta velocity for all the cells, deltaVelocity = UpdatedVelocity-InitialVelocity, together with the
+//max velocity in the system, the kinetic energy and the divergence norms.
+//Each chunk reduces its cells in registers in a single loop over the arrays, the per chunk results are merged in
+//chunk order. Nothing is allocated once the chunk buffer reached its size
+void Grid::velocityUpdate(size_t _nChunks)
 {
-    std::vector<float> velocityUSquared(m_size,0.0f);
-    std::vector<float> velocityVSquared(m_size,0.0f);
-    std::vector<float> velocityUVSum(m_size,0.0f);
+    _nChunks = parallelChunks(m_size,_nChunks);
+    m_chunkVelocityStats.resize(_nChunks);
 
-    std::transform(m_gridVelocityU.begin(),m_gridVelocityU.end(),
-                   m_gridVelocityU.begin(),velocityUSquared.begin(),std::multiplies<float>());
+    parallelFor(m_size,_nChunks,[this](size_t _begin, size_t _end, size_t _chunk)
+    {
+        const float* velocityU = m_gridVelocityU.data();
+        const float* velocityV = m_gridVelocityV.data();
+        const float* initialVelocityU = m_gridInitialVelocityU.data();
+        const float* initialVelocityV = m_gridInitialVelocityV.data();
+        float* deltaVelocityU = m_gridDeltaVelocityU.data();
+        float* deltaVelocityV = m_gridDeltaVelocityV.data();
+        const Label* label = m_gridLabel.data();
+
+        float maxSquared = 0.0f;
+        double energy = 0.0;
+        double divergenceSquared = 0.0;
+        float divergenceMax = 0.0f;
+        size_t fluidCells = 0;
+
+        //one cell, given the velocity on its E and N faces. The divergence only counts for the FLUID cells, through
+        //a mask instead of a branch
+        auto accumulate = [&](size_t _i, float _E_velocityU, float _N_velocityV)
+        {
+            deltaVelocityU[_i] = velocityU[_i]-initialVelocityU[_i];
+            deltaVelocityV[_i] = velocityV[_i]-initialVelocityV[_i];
+
+            float squared = velocityU[_i]*velocityU[_i] + velocityV[_i]*velocityV[_i];
+            maxSquared = std::max(maxSquared,squared);
+            energy += squared;
+
+            float fluid = label[_i]==Label::FLUID ? 1.0f : 0.0f;
+            float divergence = fluid*((_E_velocityU-velocityU[_i]) + (_N_velocityV-velocityV[_i]));
+            divergenceSquared += divergence*divergence;
+            divergenceMax = std::max(divergenceMax,std::abs(divergence));
+            fluidCells += label[_i]==Label::FLUID;
+        };
+
+        //the cells are walked row by row: the last cell of a row has no E face and the last row no N faces, which
+        //count as 0, so the inner loop needs no bound checks. The N faces are the next row, still in cache
+        size_t row = _begin/m_nColumns;
+        for(size_t begin = _begin; begin<_end; ++row)
+        {
+            size_t rowEnd = (row+1)*m_nColumns;
+            size_t end = std::min(_end,rowEnd);
+            size_t interiorEnd = std::min(end,rowEnd-1);
+            float N_mask = row+1<m_nRows ? 1.0f : 0.0f;
+            const float* N_velocityV = row+1<m_nRows ? velocityV+m_nColumns : velocityV;
+
+            for(size_t i = begin; i<interiorEnd; ++i)
+            {
+                accumulate(i,velocityU[i+1],N_mask*N_velocityV[i]);
+            }
+            if(end == rowEnd)
+            {
+                accumulate(rowEnd-1,0.0f,N_mask*N_velocityV[rowEnd-1]);
+            }
+
+            begin = end;
+        }
 
-    std::transform(m_gridVelocityV.begin(),m_gridVelocityV.end(),
-                   m_gridVelocityV.begin(),velocityVSquared.begin(),std::multiplies<float>());
+        GridVelocityStats& stats = m_chunkVelocityStats[_chunk];
+        stats.m_maxVelocity = maxSquared;
+        stats.m_kineticEnergy = energy;
+        stats.m_divergenceL2 = divergenceSquared;
+        stats.m_divergenceMax = divergenceMax;
+        stats.m_fluidCells = fluidCells;
+    });
+
+    //the chunks hold the squared speed and divergence
+    GridVelocityStats stats;
+    for(const GridVelocityStats& chunk : m_chunkVelocityStats)
+    {
+        stats.m_maxVelocity = std::max(stats.m_maxVelocity,chunk.m_maxVelocity);
+        stats.m_kineticEnergy += chunk.m_kineticEnergy;
+        stats.m_divergenceL2 += chunk.m_divergenceL2;
+        stats.m_divergenceMax = std::max(stats.m_divergenceMax,chunk.m_divergenceMax);
+        stats.m_fluidCells += chunk.m_fluidCells;
+    }
+    stats.m_maxVelocity = std::sqrt(stats.m_maxVelocity);
+    stats.m_kineticEnergy *= 0.5*m_deltaU*m_deltaV;
+    stats.m_divergenceL2 = std::sqrt(stats.m_divergenceL2);
 
-    std::transform(velocityUSquared.begin(),velocityUSquared.end(),
-                   velocityVSquared.begin(),velocityUVSum.begin(),std::plus<float>());
+    m_velocityStats = stats;
+}
 
-    std::vector<float>::iterator max;
-    max = std::max_element(velocityUVSum.begin(),velocityUVSum.end());
+//----------------------------------------------------------------------------------------------------------------------
+//returns the index of the cell containing the point. Points outside the grid are clamped to the closest cell
+size_t Grid::cellIndex(const vec2 _point) const
+{
+    float x = std::floor(_point.m_x/m_deltaU);
+    float y = std::floor(_point.m_y/m_deltaV);
 
-    m_maxVelocity = std::sqrt(*max);
+    x = x < 0.0f ? 0.0f : x;
+    x = x > m_nColumns-1 ? m_nColumns-1 : x;
+    y = y < 0.0f ? 0.0f : y;
+    y = y > m_nRows-1 ? m_nRows-1 : y;
+
+    return static_cast<size_t>(y)*m_nColumns + static_cast<size_t>(x);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//counting sort of the particles by cell index.
+//Writes the particle cell index and reorders the particles so that the particles of each cell are contiguous,
+//keeping their relative order. Offsets and counts per cell are stored in the grid.
+void Grid::sortParticles(ParticlePool& _particles)
+{
+    size_t nParticles = _particles.size();
+    const float* positionX = _particles.positionX();
+    const float* positionY = _particles.positionY();
+    uint32_t* particleCell = _particles.cellIndex();
+
+    std::fill(m_particleCount.begin(),m_particleCount.end(),0);
+    for(size_t i = 0; i<nParticles; ++i)
+    {
+        particleCell[i] = static_cast<uint32_t>(cellIndex(vec2(positionX[i],positionY[i])));
+        ++m_particleCount[particleCell[i]];
+    }
+
+    sortIndexedParticles(_particles);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-//calculates the delta velocity for all the cells.
-//deltaVelocity = InitialVelocity-UpdatedVelocity
-void Grid::deltaVelocityUpdate()
+//counting sort of the particles, given their cell index and the particle count of every cell
+void Grid::sortIndexedParticles(ParticlePool& _particles)
 {
-    m_gridDeltaVelocityU.clear();
-    std::transform(m_gridVelocityU.begin(),m_gridVelocityU.end(),
-                   m_gridInitialVelocityU.begin(),m_gridDeltaVelocityU.begin(),std::minus<float>());
+    size_t nParticles = _particles.size();
+    const uint32_t* particleCell = _particles.cellIndex();
 
-    m_gridDeltaVelocityV.clear();
-    std::transform(m_gridVelocityV.begin(),m_gridVelocityV.end(),
-                   m_gridInitialVelocityV.begin(),m_gridDeltaVelocityV.begin(),std::minus<float>());
+    //inclusive prefix sum, m_particleOffset[i] is the end of the bucket i
+    size_t sum = 0;
+    for(size_t i = 0; i<m_size; ++i)
+    {
+        sum += m_particleCount[i];
+        m_particleOffset[i] = sum;
+    }
+    m_particleOffset[m_size] = sum;
+
+    //find the destination of each particle, walking backwards so that the relative order is kept.
+    //At the end m_particleOffset[i] is the start of the bucket i
+    m_sortDestination.resize(nParticles);
+    for(size_t i = nParticles; i-- > 0;)
+    {
+        m_sortDestination[i] = static_cast<uint32_t>(--m_particleOffset[particleCell[i]]);
+    }
 
+    _particles.scatter(m_sortDestination,m_sortedParticles);
+    _particles.swap(m_sortedParticles);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -322,11 +506,18 @@ void Grid::resetInitialVelocity()
     std::fill(m_gridInitialVelocityV.begin(),m_gridInitialVelocityV.end(),0.0f);
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+//copies the initial velocity, as retreived from the particles, into the updated velocity
+void Grid::applyInitialVelocity()
+{
+    std::copy(m_gridInitialVelocityU.begin(),m_gridInitialVelocityU.end(),m_gridVelocityU.begin());
+    std::copy(m_gridInitialVelocityV.begin(),m_gridInitialVelocityV.end(),m_gridVelocityV.begin());
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 float Grid::density(const size_t _x,const size_t _y)
 {
-    Cell c = m_gridCell[toIndex(_x,_y)];
-    return c.density();
+    return m_gridCell[toIndex(_x,_y)].density();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
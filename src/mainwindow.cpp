@@ -12,7 +12,8 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), m_ui(new Ui::Main
     m_ui->setupUi(this);
 
     this->setFluidSimulator(new FluidSimulator());
-    this->setViewer(new View(this, m_fluidsimulator));
+    this->setSimulationWorker(new SimulationWorker(m_fluidsimulator));
+    this->setViewer(new View(this, m_simulationWorker));
 
     m_ui->s_mainWindowGridLayout->addWidget(m_view,0,0,2,1);
 
@@ -31,6 +32,8 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), m_ui(new Ui::Main
 //----------------------------------------------------------------------------------------------------------------------
 MainWindow::~MainWindow()
 {
+    //stops the simulation thread before the simulator is deleted
+    delete m_simulationWorker;
     delete m_ui;
     delete m_fluidsimulator;
     delete m_view;
@@ -46,6 +49,11 @@ void MainWindow::setViewer(View* _view){
     this->m_view = _view;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+void MainWindow::setSimulationWorker(SimulationWorker* _simulationWorker){
+    this->m_simulationWorker = _simulationWorker;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 void MainWindow::toggleGrid(bool _mode)
 {
@@ -57,6 +65,7 @@ void MainWindow::toggleGrid(bool _mode)
 void MainWindow::toggleVelocityField(bool _mode)
 {
     m_view->setDisplayVelocityField(_mode);
+    m_simulationWorker->setSnapshotContent(_mode,m_ui->m_displayActiveCells_CkBox->isChecked());
     update();
 }
 
@@ -71,6 +80,7 @@ void MainWindow::toggleParticles(bool _mode)
 void MainWindow::toggleActiveCells(bool _mode)
 {
     m_view->setDisplayActiveCells(_mode);
+    m_simulationWorker->setSnapshotContent(m_ui->m_displayVelocityField_CkBox->isChecked(),_mode);
     update();
 }
 
@@ -84,17 +94,17 @@ void MainWindow::toggleBoundaries(bool _mode)
 //----------------------------------------------------------------------------------------------------------------------
 void MainWindow::togglePressureSolver(bool _mode)
 {
-    m_fluidsimulator->setPressureSolverMode(_mode);
+    m_simulationWorker->setPressureSolverMode(_mode);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 void MainWindow::togglePlayStop()
 {
-    m_view->togglePlaySimulation();
+    m_simulationWorker->togglePlay();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 void MainWindow::nextFrame()
 {
-    m_view->togglePlayNextFrame();
+    m_simulationWorker->nextFrame();
 }
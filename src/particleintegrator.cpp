@@ -0,0 +1,171 @@
+#include "particleintegrator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file particleintegrator.cpp
+/// @brief implementation files for the particle integrators
+//----------------------------------------------------------------------------------------------------------------------
+
+//the points are integrated in blocks, so the intermediate stages stay in the cache
+static const size_t s_blockSize = 256;
+
+//----------------------------------------------------------------------------------------------------------------------
+void integrateParticles(ParticleIntegrator _integrator, const Grid& _grid, float _timeStep,
+                        float* _x, float* _y, size_t _count)
+{
+    float u[s_blockSize];
+    float v[s_blockSize];
+    float stageX[s_blockSize];
+    float stageY[s_blockSize];
+    float sumU[s_blockSize];
+    float sumV[s_blockSize];
+
+    for(size_t begin = 0; begin<_count; begin+=s_blockSize)
+    {
+        size_t count = std::min(s_blockSize,_count-begin);
+        float* x = _x+begin;
+        float* y = _y+begin;
+
+        //k1, the velocity at the point
+        _grid.sampleVelocity(x,y,u,v,count);
+
+        switch(_integrator)
+        {
+        case ParticleIntegrator::FORWARD_EULER:
+            for(size_t i = 0; i<count; ++i)
+            {
+                x[i] += _timeStep*u[i];
+                y[i] += _timeStep*v[i];
+            }
+            break;
+
+        case ParticleIntegrator::MIDPOINT_RK2:
+            //x += dt*k2, k2 sampled half a step along k1
+            for(size_t i = 0; i<count; ++i)
+            {
+                stageX[i] = x[i] + 0.5f*_timeStep*u[i];
+                stageY[i] = y[i] + 0.5f*_timeStep*v[i];
+            }
+            _grid.sampleVelocity(stageX,stageY,u,v,count);
+            for(size_t i = 0; i<count; ++i)
+            {
+                x[i] += _timeStep*u[i];
+                y[i] += _timeStep*v[i];
+            }
+            break;
+
+        case ParticleIntegrator::RALSTON_RK3:
+            //x += dt*(2/9 k1 + 3/9 k2 + 4/9 k3), k2 sampled half a step along k1, k3 three quarters along k2
+            for(size_t i = 0; i<count; ++i)
+            {
+                sumU[i] = (2.0f/9.0f)*u[i];
+                sumV[i] = (2.0f/9.0f)*v[i];
+                stageX[i] = x[i] + 0.5f*_timeStep*u[i];
+                stageY[i] = y[i] + 0.5f*_timeStep*v[i];
+            }
+            _grid.sampleVelocity(stageX,stageY,u,v,count);
+            for(size_t i = 0; i<count; ++i)
+            {
+                sumU[i] += (3.0f/9.0f)*u[i];
+                sumV[i] += (3.0f/9.0f)*v[i];
+                stageX[i] = x[i] + 0.75f*_timeStep*u[i];
+                stageY[i] = y[i] + 0.75f*_timeStep*v[i];
+            }
+            _grid.sampleVelocity(stageX,stageY,u,v,count);
+            for(size_t i = 0; i<count; ++i)
+            {
+                x[i] += _timeStep*(sumU[i] + (4.0f/9.0f)*u[i]);
+                y[i] += _timeStep*(sumV[i] + (4.0f/9.0f)*v[i]);
+            }
+            break;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//integral from 0 to _s of the velocity sampled on a grid of unit cells, floor(t)+0.5
+static double stepIntegral(double _s)
+{
+    double cell = std::floor(_s);
+    return 0.5*cell*cell + (_s-cell)*(cell+0.5);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//the sampled rotation keeps u constant in each row and v constant in each column, so the points do not move on circles
+//but on the level sets of H(x,y) = P(x)+P(y), with P(s) the integral from the centre to s of the sampled velocity
+static double invariant(double _x, double _y, double _centre)
+{
+    double centre = stepIntegral(_centre);
+    return stepIntegral(_x) - centre - _centre*(_x-_centre) + stepIntegral(_y) - centre - _centre*(_y-_centre);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//carries the points for _revolutions revolutions of a rotation with unit angular velocity, with the given CFL number at
+//_radius
+static void revolve(ParticleIntegrator _integrator, const Grid& _grid, size_t _radius, float _cfl, size_t _revolutions,
+                    std::vector<float>& _x, std::vector<float>& _y)
+{
+    const double twoPi = 2.0*std::acos(-1.0);
+
+    //the speed at the ring is _radius cells per unit time
+    size_t steps = static_cast<size_t>(std::ceil(twoPi*_radius/_cfl));
+    float timeStep = static_cast<float>(twoPi/steps);
+    for(size_t k = 0; k<steps*_revolutions; ++k)
+    {
+        integrateParticles(_integrator,_grid,timeStep,_x.data(),_y.data(),_x.size());
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+float measureStableCFL(ParticleIntegrator _integrator, size_t _radius, float _growth, size_t _revolutions)
+{
+    //solid body rotation around the centre of a grid of unit cells, u = -(y-centre), v = x-centre. The grid has room
+    //for the points to spiral out before they leave it
+    size_t n = 4*_radius+4;
+    float centre = 0.5f*n;
+    Grid grid(n,n,n,n);
+    for(size_t y = 0; y<n; ++y)
+    {
+        for(size_t x = 0; x<n; ++x)
+        {
+            //U lives on the W face, V on the S face
+            grid.cell(x,y).setVelocityU(-(y+0.5f-centre));
+            grid.cell(x,y).setVelocityV(x+0.5f-centre);
+        }
+    }
+
+    const size_t nPoints = 16;
+    std::vector<float> startX(nPoints);
+    std::vector<float> startY(nPoints);
+    for(size_t i = 0; i<nPoints; ++i)
+    {
+        double angle = 2.0*std::acos(-1.0)*i/nPoints;
+        startX[i] = centre + _radius*static_cast<float>(std::cos(angle));
+        startY[i] = centre + _radius*static_cast<float>(std::sin(angle));
+    }
+
+    //the CFL number grows by 10% until the invariant grows by more than _growth, up to four radians per substep
+    float stable = 0.0f;
+    for(float cfl = 0.01f; cfl<=4*_radius; cfl *= 1.1f)
+    {
+        std::vector<float> x = startX;
+        std::vector<float> y = startY;
+        revolve(_integrator,grid,_radius,cfl,_revolutions,x,y);
+
+        bool bounded = true;
+        for(size_t i = 0; i<nPoints && bounded; ++i)
+        {
+            double end = invariant(x[i],y[i],centre);
+            bounded = std::isfinite(end) && end <= _growth*invariant(startX[i],startY[i],centre);
+        }
+
+        if(!bounded)
+            break;
+        stable = cfl;
+    }
+
+    return stable;
+}
@@ -0,0 +1,91 @@
+#include "particlepool.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file particlepool.cpp
+/// @brief implementation files for ParticlePool class
+//----------------------------------------------------------------------------------------------------------------------
+void ParticlePool::reserve(size_t _size)
+{
+    m_positionX.reserve(_size);
+    m_positionY.reserve(_size);
+    m_velocityX.reserve(_size);
+    m_velocityY.reserve(_size);
+    m_cellIndex.reserve(_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ParticlePool::resize(size_t _size)
+{
+    m_positionX.resize(_size,0.0f);
+    m_positionY.resize(_size,0.0f);
+    m_velocityX.resize(_size,0.0f);
+    m_velocityY.resize(_size,0.0f);
+    m_cellIndex.resize(_size,0);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ParticlePool::clear()
+{
+    m_positionX.clear();
+    m_positionY.clear();
+    m_velocityX.clear();
+    m_velocityY.clear();
+    m_cellIndex.clear();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ParticlePool::push_back(const Particle& _p)
+{
+    m_positionX.push_back(_p.m_position.m_x);
+    m_positionY.push_back(_p.m_position.m_y);
+    m_velocityX.push_back(_p.m_velocity.m_x);
+    m_velocityY.push_back(_p.m_velocity.m_y);
+    m_cellIndex.push_back(static_cast<uint32_t>(_p.m_cellIndex));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void ParticlePool::swap(ParticlePool& _other)
+{
+    m_positionX.swap(_other.m_positionX);
+    m_positionY.swap(_other.m_positionY);
+    m_velocityX.swap(_other.m_velocityX);
+    m_velocityY.swap(_other.m_velocityY);
+    m_cellIndex.swap(_other.m_cellIndex);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//moves each particle to its destination index in the output pool, one array at a time
+void ParticlePool::scatter(const std::vector<uint32_t>& _destination, ParticlePool& _out) const
+{
+    size_t n = size();
+    _out.resize(n);
+
+    for(size_t i = 0; i<n; ++i)
+    {
+        _out.m_positionX[_destination[i]] = m_positionX[i];
+    }
+    for(size_t i = 0; i<n; ++i)
+    {
+        _out.m_positionY[_destination[i]] = m_positionY[i];
+    }
+    for(size_t i = 0; i<n; ++i)
+    {
+        _out.m_velocityX[_destination[i]] = m_velocityX[i];
+    }
+    for(size_t i = 0; i<n; ++i)
+    {
+        _out.m_velocityY[_destination[i]] = m_velocityY[i];
+    }
+    for(size_t i = 0; i<n; ++i)
+    {
+        _out.m_cellIndex[_destination[i]] = m_cellIndex[i];
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+Particle ParticlePool::at(size_t _i) const
+{
+    Particle p(position(_i),velocity(_i));
+    p.m_cellIndex = m_cellIndex[_i];
+    return p;
+}
@@ -0,0 +1,337 @@
+#include "pressuremultigrid.h"
+
+#include <algorithm>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file pressuremultigrid.cpp
+/// @brief implementation files for PressureMultigridPreconditioner class
+//----------------------------------------------------------------------------------------------------------------------
+PressureMultigridPreconditioner& PressureMultigridPreconditioner::factorize(const PressureOperator& _operator)
+{
+    m_operator = &_operator;
+    const Grid* grid = _operator.grid();
+
+    m_levels.clear();
+    m_levels.push_back(Level());
+
+    Level& finest = m_levels.back();
+    finest.m_nColumns = grid->nColumns();
+    finest.m_nRows = grid->nRows();
+    finest.m_scale = _operator.scale();
+    finest.m_label.resize(grid->size());
+    for(size_t i = 0; i<grid->size(); ++i)
+    {
+        finest.m_label[i] = grid->label(i);
+    }
+
+    //coarsen until the level is small enough to be solved by smoothing only
+    while(std::min(m_levels.back().m_nColumns,m_levels.back().m_nRows) > 4)
+    {
+        Level coarse;
+        restrictLabels(m_levels.back(),coarse);
+        m_levels.push_back(coarse);
+    }
+
+    for(auto& level : m_levels)
+    {
+        size_t size = level.m_nColumns*level.m_nRows;
+        level.m_x.assign(size,0.0);
+        level.m_b.assign(size,0.0);
+        level.m_r.assign(size,0.0);
+    }
+
+    return *this;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+PressureMultigridPreconditioner& PressureMultigridPreconditioner::update(const PressureOperator& _operator,
+                                                                         const std::vector<size_t>& _changedCells)
+{
+    const Grid* grid = _operator.grid();
+    if(m_levels.empty() || m_levels.front().m_label.size() != grid->size() ||
+       _changedCells.size() > m_rebuildFraction*grid->size())
+    {
+        return factorize(_operator);
+    }
+
+    m_operator = &_operator;
+
+    //the time step changes the scale of every level
+    double scale = _operator.scale();
+    for(auto& level : m_levels)
+    {
+        level.m_scale = scale;
+        scale /= 2.0;
+    }
+
+    Level& finest = m_levels.front();
+    std::vector<size_t> changed;
+    for(size_t i : _changedCells)
+    {
+        if(finest.m_label[i] != grid->label(i))
+        {
+            finest.m_label[i] = grid->label(i);
+            changed.push_back(i);
+        }
+    }
+
+    //restricts again the parents of the changed cells, until a level is left unchanged
+    std::vector<size_t> parents;
+    for(size_t l = 1; l<m_levels.size() && !changed.empty(); ++l)
+    {
+        const Level& fine = m_levels[l-1];
+        Level& coarse = m_levels[l];
+
+        parents.clear();
+        for(size_t i : changed)
+        {
+            parents.push_back((i/fine.m_nColumns/2)*coarse.m_nColumns + (i%fine.m_nColumns)/2);
+        }
+        std::sort(parents.begin(),parents.end());
+        parents.erase(std::unique(parents.begin(),parents.end()),parents.end());
+
+        changed.clear();
+        for(size_t i : parents)
+        {
+            Label label = restrictLabel(fine,i%coarse.m_nColumns,i/coarse.m_nColumns);
+            if(coarse.m_label[i] != label)
+            {
+                coarse.m_label[i] = label;
+                changed.push_back(i);
+            }
+        }
+    }
+
+    return *this;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void PressureMultigridPreconditioner::restrictLabels(const Level& _fine, Level& _coarse) const
+{
+    _coarse.m_nColumns = (_fine.m_nColumns+1)/2;
+    _coarse.m_nRows = (_fine.m_nRows+1)/2;
+
+    //same stencil with the scale of the Galerkin operator R*A*P of the transfers of vCycle, average restriction and
+    //injection: half the fine scale, where rediscretising with twice the cell size would give a quarter of it
+    _coarse.m_scale = _fine.m_scale/2.0;
+    _coarse.m_label.resize(_coarse.m_nColumns*_coarse.m_nRows);
+
+    for(size_t y = 0; y<_coarse.m_nRows; ++y)
+    {
+        for(size_t x = 0; x<_coarse.m_nColumns; ++x)
+        {
+            _coarse.m_label[y*_coarse.m_nColumns+x] = restrictLabel(_fine,x,y);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//a coarse cell is EMPTY if any child is EMPTY, FLUID if any child is FLUID, SOLID otherwise
+Label PressureMultigridPreconditioner::restrictLabel(const Level& _fine, size_t _column, size_t _row) const
+{
+    Label parent = Label::SOLID;
+    for(size_t y = 2*_row; y<std::min(2*_row+2,_fine.m_nRows); ++y)
+    {
+        for(size_t x = 2*_column; x<std::min(2*_column+2,_fine.m_nColumns); ++x)
+        {
+            Label child = _fine.m_label[y*_fine.m_nColumns+x];
+            if(child == Label::EMPTY)
+                return Label::EMPTY;
+            if(child == Label::FLUID)
+                parent = Label::FLUID;
+        }
+    }
+    return parent;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//one Gauss-Seidel sweep over the cells of one colour, (x+y)%2 == _colour
+void PressureMultigridPreconditioner::smooth(const Level& _level, size_t _colour) const
+{
+    size_t nColumns = _level.m_nColumns;
+    size_t nRows = _level.m_nRows;
+    const Label* label = _level.m_label.data();
+    double* x = _level.m_x.data();
+    const double* b = _level.m_b.data();
+
+    size_t i;
+    size_t nonSolid;
+    double sum;
+    for(size_t row = 0; row<nRows; ++row)
+    {
+        for(size_t column = (row+_colour)%2; column<nColumns; column+=2)
+        {
+            i = row*nColumns+column;
+            if(label[i] != Label::FLUID)
+            {
+                x[i] = b[i];
+                continue;
+            }
+
+            nonSolid = 0;
+            sum = 0.0;
+            if(column>=1 && label[i-1] != Label::SOLID)
+            {
+                ++nonSolid;
+                if(label[i-1] == Label::FLUID) sum += x[i-1];
+            }
+            if(column+1<nColumns && label[i+1] != Label::SOLID)
+            {
+                ++nonSolid;
+                if(label[i+1] == Label::FLUID) sum += x[i+1];
+            }
+            if(row>=1 && label[i-nColumns] != Label::SOLID)
+            {
+                ++nonSolid;
+                if(label[i-nColumns] == Label::FLUID) sum += x[i-nColumns];
+            }
+            if(row+1<nRows && label[i+nColumns] != Label::SOLID)
+            {
+                ++nonSolid;
+                if(label[i+nColumns] == Label::FLUID) sum += x[i+nColumns];
+            }
+
+            //a FLUID cell closed by SOLID cells has no pressure equation
+            x[i] = nonSolid > 0 ? (b[i]/_level.m_scale + sum)/nonSolid : 0.0;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//r = b - A*x on the FLUID cells of the level
+void PressureMultigridPreconditioner::residual(const Level& _level) const
+{
+    size_t nColumns = _level.m_nColumns;
+    size_t nRows = _level.m_nRows;
+    const Label* label = _level.m_label.data();
+    const double* x = _level.m_x.data();
+    const double* b = _level.m_b.data();
+    double* r = _level.m_r.data();
+
+    size_t i;
+    size_t nonSolid;
+    double sum;
+    for(size_t row = 0; row<nRows; ++row)
+    {
+        for(size_t column = 0; column<nColumns; ++column)
+        {
+            i = row*nColumns+column;
+            if(label[i] != Label::FLUID)
+            {
+                r[i] = 0.0;
+                continue;
+            }
+
+            nonSolid = 0;
+            sum = 0.0;
+            if(column>=1 && label[i-1] != Label::SOLID)
+            {
+                ++nonSolid;
+                if(label[i-1] == Label::FLUID) sum += x[i-1];
+            }
+            if(column+1<nColumns && label[i+1] != Label::SOLID)
+            {
+                ++nonSolid;
+                if(label[i+1] == Label::FLUID) sum += x[i+1];
+            }
+            if(row>=1 && label[i-nColumns] != Label::SOLID)
+            {
+                ++nonSolid;
+                if(label[i-nColumns] == Label::FLUID) sum += x[i-nColumns];
+            }
+            if(row+1<nRows && label[i+nColumns] != Label::SOLID)
+            {
+                ++nonSolid;
+                if(label[i+nColumns] == Label::FLUID) sum += x[i+nColumns];
+            }
+
+            r[i] = b[i] - _level.m_scale*(nonSolid*x[i] - sum);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void PressureMultigridPreconditioner::vCycle(size_t _level) const
+{
+    const Level& level = m_levels[_level];
+    std::fill(level.m_x.begin(),level.m_x.end(),0.0);
+
+    //coarsest level, symmetric sequence of sweeps red,black,...,black,red
+    if(_level+1 == m_levels.size())
+    {
+        for(size_t k = 0; k<m_coarseSteps; ++k)
+        {
+            smooth(level,0);
+            smooth(level,1);
+        }
+        smooth(level,0);
+        return;
+    }
+
+    //pre smoothing red,black
+    for(size_t k = 0; k<m_smoothingSteps; ++k)
+    {
+        smooth(level,0);
+        smooth(level,1);
+    }
+
+    //restriction of the residual, average of the FLUID children
+    residual(level);
+    const Level& coarse = m_levels[_level+1];
+    std::fill(coarse.m_b.begin(),coarse.m_b.end(),0.0);
+    for(size_t y = 0; y<level.m_nRows; ++y)
+    {
+        for(size_t x = 0; x<level.m_nColumns; ++x)
+        {
+            size_t i = y*level.m_nColumns+x;
+            if(level.m_label[i] == Label::FLUID)
+                coarse.m_b[(y/2)*coarse.m_nColumns+x/2] += 0.25*level.m_r[i];
+        }
+    }
+    for(size_t i = 0; i<coarse.m_b.size(); ++i)
+    {
+        if(coarse.m_label[i] != Label::FLUID)
+            coarse.m_b[i] = 0.0;
+    }
+
+    vCycle(_level+1);
+
+    //prolongation of the correction by injection, scaled by the over-correction
+    for(size_t y = 0; y<level.m_nRows; ++y)
+    {
+        for(size_t x = 0; x<level.m_nColumns; ++x)
+        {
+            size_t i = y*level.m_nColumns+x;
+            size_t parent = (y/2)*coarse.m_nColumns+x/2;
+            if(level.m_label[i] == Label::FLUID && coarse.m_label[parent] == Label::FLUID)
+                level.m_x[i] += m_overCorrection*coarse.m_x[parent];
+        }
+    }
+
+    //post smoothing black,red
+    for(size_t k = 0; k<m_smoothingSteps; ++k)
+    {
+        smooth(level,1);
+        smooth(level,0);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void PressureMultigridPreconditioner::applyInverse(const double* _b, double* _x) const
+{
+    const Level& finest = m_levels.front();
+    size_t size = static_cast<size_t>(m_operator->rows());
+
+    std::fill(finest.m_b.begin(),finest.m_b.end(),0.0);
+    for(size_t i = 0; i<size; ++i)
+    {
+        finest.m_b[m_operator->cell(i)] = _b[i];
+    }
+
+    vCycle(0);
+
+    for(size_t i = 0; i<size; ++i)
+    {
+        _x[i] = finest.m_x[m_operator->cell(i)];
+    }
+}
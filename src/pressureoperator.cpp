@@ -0,0 +1,341 @@
+#include "pressureoperator.h"
+
+#include <cmath>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file pressureoperator.cpp
+/// @brief implementation files for PressureOperator class
+//----------------------------------------------------------------------------------------------------------------------
+PressureOperator::PressureOperator()
+{
+    m_grid = nullptr;
+    m_size = 0;
+    m_scale = 0.0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void PressureOperator::setUp(Grid* _grid, float _timeStep)
+{
+    m_grid = _grid;
+
+    double dx = _grid->deltaU();
+    m_scale = _timeStep/(dx*dx);
+
+    //only the stencil of the FLUID cells is read, update() keeps it valid as the labels change
+    m_cellStencil.assign(_grid->size(),0);
+    setUpRows(true);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//a label change only alters the stencil of the cell and of its 4 neighbours
+void PressureOperator::update(Grid* _grid, float _timeStep, const std::vector<size_t>& _changedCells)
+{
+    if(_grid != m_grid || m_cellStencil.size() != _grid->size())
+    {
+        setUp(_grid,_timeStep);
+        return;
+    }
+
+    double dx = _grid->deltaU();
+    m_scale = _timeStep/(dx*dx);
+
+    size_t nColumns = _grid->nColumns();
+    size_t nRows = _grid->nRows();
+    for(size_t i : _changedCells)
+    {
+        size_t x = i%nColumns;
+        size_t y = i/nColumns;
+
+        setUpStencil(i,x,y);
+        if(x>=1)            setUpStencil(i-1,x-1,y);
+        if(x+1<nColumns)    setUpStencil(i+1,x+1,y);
+        if(y>=1)            setUpStencil(i-nColumns,x,y-1);
+        if(y+1<nRows)       setUpStencil(i+nColumns,x,y+1);
+    }
+
+    //the rows are numbered in cell order, so a new FLUID cell shifts all the rows after it
+    if(!_changedCells.empty())
+        setUpRows(false);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//stencil byte of the cell at column _x and row _y
+void PressureOperator::setUpStencil(size_t _cell, size_t _x, size_t _y)
+{
+    size_t nColumns = m_grid->nColumns();
+
+    //cells outside the grid count as SOLID
+    Label neighbours[4];
+    neighbours[0] = _x>=1 ? m_grid->label(_cell-1) : Label::SOLID;                           //W
+    neighbours[1] = _x+1<nColumns ? m_grid->label(_cell+1) : Label::SOLID;                   //E
+    neighbours[2] = _y>=1 ? m_grid->label(_cell-nColumns) : Label::SOLID;                    //S
+    neighbours[3] = _y+1<m_grid->nRows() ? m_grid->label(_cell+nColumns) : Label::SOLID;     //N
+
+    unsigned char stencil = 0;
+    for(unsigned char k = 0; k<4; ++k)
+    {
+        if(neighbours[k] == Label::SOLID)
+            continue;
+
+        stencil += 1<<4;
+        if(neighbours[k] == Label::FLUID)
+            stencil |= 1<<k;
+    }
+
+    m_cellStencil[_cell] = stencil;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//numbers the FLUID cells in cell order, they are the rows of the operator. Also sets up their stencil if requested
+void PressureOperator::setUpRows(bool _stencil)
+{
+    size_t nColumns = m_grid->nColumns();
+    size_t nRows = m_grid->nRows();
+
+    m_cellRow.assign(m_grid->size(),-1);
+    m_fluidCells.clear();
+    m_fluidCells.reserve(m_size);
+    for(size_t y = 0, i = 0; y<nRows; ++y)
+    {
+        for(size_t x = 0; x<nColumns; ++x, ++i)
+        {
+            if(m_grid->label(i) != Label::FLUID)
+                continue;
+
+            m_cellRow[i] = static_cast<int>(m_fluidCells.size());
+            m_fluidCells.push_back(i);
+            if(_stencil)
+                setUpStencil(i,x,y);
+        }
+    }
+    m_size = m_fluidCells.size();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//finds the rows of the FLUID neighbours of a row and returns the number of non SOLID neighbours
+size_t PressureOperator::stencil(size_t _row, int* _fluidNeighbours) const
+{
+    size_t index = m_fluidCells[_row];
+    unsigned char cellStencil = m_cellStencil[index];
+    size_t nColumns = m_grid->nColumns();
+
+    size_t fluid = 0;
+    if(cellStencil & 1)     _fluidNeighbours[fluid++] = m_cellRow[index-1];           //W
+    if(cellStencil & 2)     _fluidNeighbours[fluid++] = m_cellRow[index+1];           //E
+    if(cellStencil & 4)     _fluidNeighbours[fluid++] = m_cellRow[index-nColumns];    //S
+    if(cellStencil & 8)     _fluidNeighbours[fluid++] = m_cellRow[index+nColumns];    //N
+
+    //marks the end of the fluid neighbours
+    if(fluid<4)
+        _fluidNeighbours[fluid] = -1;
+
+    return cellStencil>>4;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void PressureOperator::apply(const double* _x, double* _y) const
+{
+    int fluidNeighbours[4];
+    size_t nonSolid;
+    double sum;
+
+    for(size_t i = 0; i<m_size; ++i)
+    {
+        nonSolid = stencil(i,fluidNeighbours);
+
+        sum = 0.0;
+        for(size_t k = 0; k<4 && fluidNeighbours[k]>=0; ++k)
+        {
+            sum += _x[fluidNeighbours[k]];
+        }
+
+        _y[i] = m_scale*(nonSolid*_x[i] - sum);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+double PressureOperator::diagonal(size_t _row) const
+{
+    int fluidNeighbours[4];
+    return m_scale*stencil(_row,fluidNeighbours);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//A(i,j) for the row j of the E neighbour cell, 0 if it is not FLUID
+double PressureOperator::plusU(size_t _row) const
+{
+    size_t next = m_fluidCells[_row]+1;
+    if(next%m_grid->nColumns() == 0 || m_cellRow[next] < 0)
+        return 0.0;
+    return -m_scale;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//A(i,j) for the row j of the N neighbour cell, 0 if it is not FLUID
+double PressureOperator::plusV(size_t _row) const
+{
+    size_t next = m_fluidCells[_row]+m_grid->nColumns();
+    if(next>=m_grid->size() || m_cellRow[next] < 0)
+        return 0.0;
+    return -m_scale;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+Eigen::SparseMatrix<double,Eigen::RowMajor> PressureOperator::toSparseMatrix() const
+{
+    std::vector<Eigen::Triplet<double>> entries;
+    entries.reserve(5*m_size);
+
+    int fluidNeighbours[4];
+    size_t nonSolid;
+    for(size_t i = 0; i<m_size; ++i)
+    {
+        nonSolid = stencil(i,fluidNeighbours);
+        entries.push_back(Eigen::Triplet<double>(i,i,m_scale*nonSolid));
+        for(size_t k = 0; k<4 && fluidNeighbours[k]>=0; ++k)
+        {
+            entries.push_back(Eigen::Triplet<double>(i,fluidNeighbours[k],-m_scale));
+        }
+    }
+
+    Eigen::SparseMatrix<double,Eigen::RowMajor> A(m_size,m_size);
+    A.setFromTriplets(entries.begin(),entries.end());
+    return A;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+PressureJacobiPreconditioner& PressureJacobiPreconditioner::factorize(const PressureOperator& _operator)
+{
+    m_inverseDiagonal.resize(_operator.rows());
+    for(Eigen::Index i = 0; i<_operator.rows(); ++i)
+    {
+        double d = _operator.diagonal(i);
+        m_inverseDiagonal(i) = d != 0.0 ? 1.0/d : 1.0;
+    }
+    return *this;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+PressureMICPreconditioner::PressureMICPreconditioner()
+{
+    m_operator = nullptr;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+PressureMICPreconditioner::PressureMICPreconditioner(const PressureOperator& _operator)
+{
+    compute(_operator);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//computes the diagonal of the MIC(0) factor, stored as its inverse. The rows follow the cell order, so the W and S
+//neighbours of a row always come before it
+PressureMICPreconditioner& PressureMICPreconditioner::factorize(const PressureOperator& _operator)
+{
+    m_operator = &_operator;
+
+    const Grid* grid = _operator.grid();
+    size_t size = static_cast<size_t>(_operator.rows());
+    size_t nColumns = grid->nColumns();
+
+    m_precon.assign(size,0.0);
+    m_q.resize(size);
+
+    size_t cell;
+    int w;
+    int s;
+    double e;
+    double diagonal;
+    double plusUW;
+    double plusVS;
+    double plusVW;
+    double plusUS;
+    double preconW;
+    double preconS;
+    for(size_t i = 0; i<size; ++i)
+    {
+        cell = _operator.cell(i);
+        diagonal = _operator.diagonal(i);
+
+        //W neighbour
+        plusUW = 0.0;
+        plusVW = 0.0;
+        preconW = 0.0;
+        w = cell%nColumns >= 1 ? _operator.row(cell-1) : -1;
+        if(w >= 0)
+        {
+            plusUW = _operator.plusU(w);
+            plusVW = _operator.plusV(w);
+            preconW = m_precon[w];
+        }
+
+        //S neighbour
+        plusVS = 0.0;
+        plusUS = 0.0;
+        preconS = 0.0;
+        s = cell >= nColumns ? _operator.row(cell-nColumns) : -1;
+        if(s >= 0)
+        {
+            plusVS = _operator.plusV(s);
+            plusUS = _operator.plusU(s);
+            preconS = m_precon[s];
+        }
+
+        e = diagonal
+                - (plusUW*preconW)*(plusUW*preconW)
+                - (plusVS*preconS)*(plusVS*preconS)
+                - m_tau*(plusUW*plusVW*preconW*preconW
+                         + plusVS*plusUS*preconS*preconS);
+
+        if(e < m_sigma*diagonal)
+            e = diagonal;
+
+        //a FLUID cell closed by SOLID cells has an empty row
+        m_precon[i] = e > 0.0 ? 1.0/std::sqrt(e) : 0.0;
+    }
+
+    m_isInitialized = true;
+    return *this;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//forward substitution L*q = b followed by the backward substitution L^T*x = q
+void PressureMICPreconditioner::applyInverse(const double* _b, double* _x) const
+{
+    const Grid* grid = m_operator->grid();
+    size_t size = m_precon.size();
+    size_t nColumns = grid->nColumns();
+
+    size_t cell;
+    int neighbour;
+    double t;
+    for(size_t i = 0; i<size; ++i)
+    {
+        cell = m_operator->cell(i);
+
+        t = _b[i];
+        neighbour = cell%nColumns >= 1 ? m_operator->row(cell-1) : -1;
+        if(neighbour >= 0)
+            t -= m_operator->plusU(neighbour)*m_precon[neighbour]*m_q[neighbour];
+        neighbour = cell >= nColumns ? m_operator->row(cell-nColumns) : -1;
+        if(neighbour >= 0)
+            t -= m_operator->plusV(neighbour)*m_precon[neighbour]*m_q[neighbour];
+
+        m_q[i] = t*m_precon[i];
+    }
+
+    for(size_t i = size; i-- > 0;)
+    {
+        cell = m_operator->cell(i);
+
+        t = m_q[i];
+        neighbour = (cell+1)%nColumns != 0 ? m_operator->row(cell+1) : -1;
+        if(neighbour >= 0)
+            t -= m_operator->plusU(i)*m_precon[i]*_x[neighbour];
+        neighbour = cell+nColumns < grid->size() ? m_operator->row(cell+nColumns) : -1;
+        if(neighbour >= 0)
+            t -= m_operator->plusV(i)*m_precon[i]*_x[neighbour];
+
+        _x[i] = t*m_precon[i];
+    }
+}
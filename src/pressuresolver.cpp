@@ -0,0 +1,440 @@
+#include "pressuresolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file pressuresolver.cpp
+/// @brief implementation files for the PressureSolver classes
+//----------------------------------------------------------------------------------------------------------------------
+PressureRedBlackSOR::PressureRedBlackSOR()
+{
+    m_operator = nullptr;
+
+    //below the floor the residual stops decreasing before the iteration cap
+    m_minTolerance = 1e-14;
+    setTolerance(m_tolerance);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//splits the rows by the colour of their cell, (column+row)%2, and stores their stencil
+void PressureRedBlackSOR::prepare(const PressureOperator& _operator)
+{
+    m_operator = &_operator;
+
+    size_t nColumns = _operator.grid()->nColumns();
+    size_t size = static_cast<size_t>(_operator.rows());
+
+    for(auto& colour : m_colour)
+    {
+        colour.m_row.clear();
+    }
+
+    size_t cell;
+    for(size_t i = 0; i<size; ++i)
+    {
+        cell = _operator.cell(i);
+        m_colour[(cell%nColumns + cell/nColumns)%2].m_row.push_back(static_cast<int>(i));
+    }
+
+    for(auto& colour : m_colour)
+    {
+        prepareColour(colour);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void PressureRedBlackSOR::prepareColour(Colour& _colour) const
+{
+    size_t count = _colour.m_row.size();
+    int padding = static_cast<int>(m_operator->rows());
+
+    for(auto& neighbour : _colour.m_neighbour)
+    {
+        neighbour.resize(count);
+    }
+    _colour.m_count.resize(count);
+    _colour.m_inverseCount.resize(count);
+
+    int fluidNeighbours[4];
+    size_t nonSolid;
+    for(size_t j = 0; j<count; ++j)
+    {
+        nonSolid = m_operator->stencil(_colour.m_row[j],fluidNeighbours);
+
+        bool end = false;
+        for(size_t k = 0; k<4; ++k)
+        {
+            end = end || fluidNeighbours[k] < 0;
+            _colour.m_neighbour[k][j] = end ? padding : fluidNeighbours[k];
+        }
+
+        //a FLUID cell closed by SOLID cells has no pressure equation, its value goes to zero
+        _colour.m_count[j] = static_cast<double>(nonSolid);
+        _colour.m_inverseCount[j] = nonSolid > 0 ? 1.0/nonSolid : 0.0;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//x += omega*(x_GaussSeidel - x) on the rows [_begin,_end) of the colour
+void PressureRedBlackSOR::sweep(const Colour& _colour, size_t _begin, size_t _end)
+{
+    const int* row = _colour.m_row.data();
+    const int* n0 = _colour.m_neighbour[0].data();
+    const int* n1 = _colour.m_neighbour[1].data();
+    const int* n2 = _colour.m_neighbour[2].data();
+    const int* n3 = _colour.m_neighbour[3].data();
+    const double* inverseCount = _colour.m_inverseCount.data();
+    const double* b = m_b.data();
+    double* x = m_x.data();
+    double omega = m_omega;
+
+    for(size_t j = _begin; j<_end; ++j)
+    {
+        int i = row[j];
+        double sum = x[n0[j]] + x[n1[j]] + x[n2[j]] + x[n3[j]];
+        x[i] += omega*((b[i] + sum)*inverseCount[j] - x[i]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//squared residual of the rows [_begin,_end) of the colour, in units of b/scale
+double PressureRedBlackSOR::residual(const Colour& _colour, size_t _begin, size_t _end) const
+{
+    const int* row = _colour.m_row.data();
+    const int* n0 = _colour.m_neighbour[0].data();
+    const int* n1 = _colour.m_neighbour[1].data();
+    const int* n2 = _colour.m_neighbour[2].data();
+    const int* n3 = _colour.m_neighbour[3].data();
+    const double* count = _colour.m_count.data();
+    const double* b = m_b.data();
+    const double* x = m_x.data();
+
+    double result = 0.0;
+    for(size_t j = _begin; j<_end; ++j)
+    {
+        int i = row[j];
+        double sum = x[n0[j]] + x[n1[j]] + x[n2[j]] + x[n3[j]];
+        double r = b[i] - (count[j]*x[i] - sum);
+        result += r*r;
+    }
+    return result;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//copies the right hand side, scaled by 1/scale, and the starting solution into the padded buffers
+void PressureRedBlackSOR::load(const Eigen::VectorXd& _b, const Eigen::VectorXd& _x, bool _guess)
+{
+    size_t size = static_cast<size_t>(_b.size());
+    double inverseScale = 1.0/m_operator->scale();
+
+    m_b.resize(size);
+    for(size_t i = 0; i<size; ++i)
+    {
+        m_b[i] = _b(i)*inverseScale;
+    }
+
+    m_x.assign(size+1,0.0);
+    if(_guess && static_cast<size_t>(_x.size()) == size)
+    {
+        std::copy(_x.data(),_x.data()+size,m_x.begin());
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//runs up to _iterations red and black sweeps. Each thread owns the same slice of both colours for the whole solve.
+//The residual is reduced in chunk order every m_checkInterval iterations, so every thread reaches the same decision
+//to stop and the result does not depend on the number of threads
+size_t PressureRedBlackSOR::iterate(size_t _iterations)
+{
+    size_t size = m_b.size();
+    size_t nChunks = parallelChunks(size/m_minRowsPerThread,m_threadCount);
+    ParallelBarrier barrier(nChunks);
+    m_partialResidual.assign(nChunks,0.0);
+
+    double bNorm2 = 0.0;
+    for(double b : m_b)
+    {
+        bNorm2 += b*b;
+    }
+
+    size_t iterations = 0;
+    double error = 0.0;
+    parallelFor(nChunks,nChunks,[&](size_t, size_t, size_t _chunk)
+    {
+        size_t begin[2];
+        size_t end[2];
+        for(size_t c = 0; c<2; ++c)
+        {
+            size_t count = m_colour[c].m_row.size();
+            begin[c] = count*_chunk/nChunks;
+            end[c] = count*(_chunk+1)/nChunks;
+        }
+
+        size_t k = 0;
+        double chunkError = 0.0;
+        while(k < _iterations)
+        {
+            sweep(m_colour[0],begin[0],end[0]);
+            barrier.wait();
+            sweep(m_colour[1],begin[1],end[1]);
+            barrier.wait();
+            ++k;
+
+            if(k%m_checkInterval == 0 || k == _iterations)
+            {
+                m_partialResidual[_chunk] = residual(m_colour[0],begin[0],end[0])
+                                          + residual(m_colour[1],begin[1],end[1]);
+                barrier.wait();
+
+                double residual2 = 0.0;
+                for(double partial : m_partialResidual)
+                {
+                    residual2 += partial;
+                }
+                chunkError = std::sqrt(residual2/bNorm2);
+                if(chunkError < m_tolerance)
+                    break;
+            }
+        }
+
+        if(_chunk == 0)
+        {
+            iterations = k;
+            error = chunkError;
+        }
+    });
+
+    m_stats.m_error = error;
+    return iterations;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+bool PressureRedBlackSOR::solve(const Eigen::VectorXd& _b, Eigen::VectorXd& _x, bool _guess)
+{
+    size_t size = static_cast<size_t>(_b.size());
+    m_stats = PressureSolverStats();
+
+    if(_b.norm() == 0.0)
+    {
+        _x = Eigen::VectorXd::Zero(size);
+        m_stats.m_converged = true;
+        return true;
+    }
+
+    load(_b,_x,_guess);
+
+    size_t maxIterations = m_maxIterations > 0 ? m_maxIterations : 10*size;
+    m_stats.m_iterations = iterate(maxIterations);
+    m_stats.m_converged = m_stats.m_error < m_tolerance;
+
+    _x = Eigen::Map<const Eigen::VectorXd>(m_x.data(),size);
+    return m_stats.m_converged;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+PressureMixedPrecisionCG::PressureMixedPrecisionCG()
+{
+    m_operator = nullptr;
+
+    //below the floor the refinement stalls on the rounding of the double residual
+    m_minTolerance = 1e-14;
+    setTolerance(m_tolerance);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void PressureMixedPrecisionCG::prepare(const PressureOperator& _operator)
+{
+    m_operator = &_operator;
+
+    size_t size = static_cast<size_t>(_operator.rows());
+    int padding = static_cast<int>(size);
+    m_offDiagonal = static_cast<float>(-_operator.scale());
+
+    m_diagonal.resize(size);
+    m_inverseDiagonal.resize(size);
+    for(auto& neighbour : m_neighbour)
+    {
+        neighbour.resize(size);
+    }
+
+    int fluidNeighbours[4];
+    for(size_t i = 0; i<size; ++i)
+    {
+        double d = _operator.scale()*_operator.stencil(i,fluidNeighbours);
+        m_diagonal[i] = static_cast<float>(d);
+        m_inverseDiagonal[i] = d != 0.0 ? static_cast<float>(1.0/d) : 1.0f;
+
+        bool end = false;
+        for(size_t k = 0; k<4; ++k)
+        {
+            end = end || fluidNeighbours[k] < 0;
+            m_neighbour[k][i] = end ? padding : fluidNeighbours[k];
+        }
+    }
+
+    m_r.resize(size);
+    m_d.resize(size);
+    m_z.resize(size);
+    m_p.assign(size+1,0.0f);
+    m_q.resize(size);
+    m_residual.resize(size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//_y = A*_x with the float stencil. _x needs the padding entry
+void PressureMixedPrecisionCG::apply(const float* _x, float* _y) const
+{
+    size_t size = m_diagonal.size();
+    const float* diagonal = m_diagonal.data();
+    const int* n0 = m_neighbour[0].data();
+    const int* n1 = m_neighbour[1].data();
+    const int* n2 = m_neighbour[2].data();
+    const int* n3 = m_neighbour[3].data();
+    float offDiagonal = m_offDiagonal;
+
+    for(size_t i = 0; i<size; ++i)
+    {
+        _y[i] = diagonal[i]*_x[i] + offDiagonal*(_x[n0[i]] + _x[n1[i]] + _x[n2[i]] + _x[n3[i]]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//diagonal preconditioned conjugate gradient in float on A*m_d = m_r, starting from m_d = 0, until the residual is
+//reduced by _tolerance. Returns the number of iterations
+size_t PressureMixedPrecisionCG::innerSolve(double _tolerance, size_t _maxIterations)
+{
+    size_t size = m_r.size();
+    float* r = m_r.data();
+    float* d = m_d.data();
+    float* z = m_z.data();
+    float* p = m_p.data();
+    float* q = m_q.data();
+    const float* inverseDiagonal = m_inverseDiagonal.data();
+
+    double rNorm2 = 0.0;
+    double rz = 0.0;
+    for(size_t i = 0; i<size; ++i)
+    {
+        d[i] = 0.0f;
+        z[i] = inverseDiagonal[i]*r[i];
+        p[i] = z[i];
+        rNorm2 += static_cast<double>(r[i])*r[i];
+        rz += static_cast<double>(r[i])*z[i];
+    }
+
+    double threshold = _tolerance*_tolerance*rNorm2;
+    size_t iterations = 0;
+    while(iterations < _maxIterations && rNorm2 > threshold)
+    {
+        apply(p,q);
+
+        double pq = 0.0;
+        for(size_t i = 0; i<size; ++i)
+        {
+            pq += static_cast<double>(p[i])*q[i];
+        }
+        if(pq <= 0.0)
+            break;
+
+        float alpha = static_cast<float>(rz/pq);
+        double rzNew = 0.0;
+        rNorm2 = 0.0;
+        for(size_t i = 0; i<size; ++i)
+        {
+            d[i] += alpha*p[i];
+            r[i] -= alpha*q[i];
+            z[i] = inverseDiagonal[i]*r[i];
+            rNorm2 += static_cast<double>(r[i])*r[i];
+            rzNew += static_cast<double>(r[i])*z[i];
+        }
+
+        float beta = static_cast<float>(rzNew/rz);
+        rz = rzNew;
+        for(size_t i = 0; i<size; ++i)
+        {
+            p[i] = z[i] + beta*p[i];
+        }
+        ++iterations;
+    }
+
+    return iterations;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+bool PressureMixedPrecisionCG::solve(const Eigen::VectorXd& _b, Eigen::VectorXd& _x, bool _guess)
+{
+    size_t size = static_cast<size_t>(_b.size());
+    m_stats = PressureSolverStats();
+    m_refinements = 0;
+
+    if(!_guess || static_cast<size_t>(_x.size()) != size)
+        _x = Eigen::VectorXd::Zero(size);
+
+    double bNorm = _b.norm();
+    if(bNorm == 0.0)
+    {
+        _x.setZero();
+        m_stats.m_converged = true;
+        return true;
+    }
+
+    size_t maxIterations = m_maxIterations > 0 ? m_maxIterations : 2*size;
+
+    m_operator->apply(_x.data(),m_residual.data());
+    m_residual = _b - m_residual;
+    m_stats.m_error = m_residual.norm()/bNorm;
+
+    while(m_stats.m_error >= m_tolerance && m_refinements < m_maxRefinements
+          && m_stats.m_iterations < maxIterations)
+    {
+        //the residual is scaled to unit norm, so that it does not underflow in float
+        double rNorm = m_residual.norm();
+        for(size_t i = 0; i<size; ++i)
+        {
+            m_r[i] = static_cast<float>(m_residual(i)/rNorm);
+        }
+
+        //asks the float solve for the reduction still needed, down to the limit float can reach
+        double target = std::max(m_innerTolerance,m_tolerance/m_stats.m_error);
+        m_stats.m_iterations += innerSolve(target,maxIterations - m_stats.m_iterations);
+        ++m_refinements;
+
+        for(size_t i = 0; i<size; ++i)
+        {
+            _x(i) += rNorm*m_d[i];
+        }
+
+        m_operator->apply(_x.data(),m_residual.data());
+        m_residual = _b - m_residual;
+
+        //stops when a refinement does not halve the residual anymore
+        double error = m_residual.norm()/bNorm;
+        bool stalled = error > 0.5*m_stats.m_error;
+        m_stats.m_error = error;
+        if(stalled)
+            break;
+    }
+
+    m_stats.m_converged = m_stats.m_error < m_tolerance;
+    return m_stats.m_converged;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+std::unique_ptr<PressureSolver> createPressureSolver(PressureSolverType _type, PressurePreconditioner _preconditioner)
+{
+    if(_type == PressureSolverType::RED_BLACK_SOR)
+        return std::unique_ptr<PressureSolver>(new PressureRedBlackSOR());
+    if(_type == PressureSolverType::MIXED_PRECISION)
+        return std::unique_ptr<PressureSolver>(new PressureMixedPrecisionCG());
+
+    switch(_preconditioner)
+    {
+        case PressurePreconditioner::MIC:
+            return std::unique_ptr<PressureSolver>(new PressureConjugateGradient<PressureMICPreconditioner>());
+        case PressurePreconditioner::MULTIGRID:
+            return std::unique_ptr<PressureSolver>(new PressureConjugateGradient<PressureMultigridPreconditioner>());
+        default:
+            return std::unique_ptr<PressureSolver>(new PressureConjugateGradient<PressureJacobiPreconditioner>());
+    }
+}
@@ -0,0 +1,170 @@
+#include "simulationworker.h"
+
+#include <limits>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file simulationworker.cpp
+/// @brief implementation files for SimulationWorker class
+//----------------------------------------------------------------------------------------------------------------------
+SimulationWorker::SimulationWorker(FluidSimulator* _simulator)
+{
+    m_simulator = _simulator;
+    m_width = m_simulator->width();
+    m_height = m_simulator->height();
+    m_nColumns = m_simulator->nColumns();
+    m_nRows = m_simulator->nRows();
+    m_cellCentres = m_simulator->cellCentres();
+    m_boundaries = m_simulator->boundaries();
+
+    //the initial state is available before the first frame
+    prepareSnapshot(false,false,FrameBudgetReport());
+
+    m_thread = std::thread(&SimulationWorker::run,this);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+SimulationWorker::~SimulationWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void SimulationWorker::togglePlay()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_playing = !m_playing;
+
+        //the last frame played may have skipped its snapshot, the paused View shows the current one
+        m_refreshRequested = !m_playing;
+    }
+    m_condition.notify_one();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//stops the simulation and runs one more frame
+void SimulationWorker::nextFrame()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_playing = false;
+        ++m_framesRequested;
+    }
+    m_condition.notify_one();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void SimulationWorker::setPressureSolverMode(bool _mode)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pressureSolverMode = _mode;
+        m_pressureSolverModeChanged = true;
+    }
+    m_condition.notify_one();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void SimulationWorker::setSnapshotContent(bool _velocityField, bool _activeCells)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_snapshotVelocityField = _velocityField;
+        m_snapshotActiveCells = _activeCells;
+        m_refreshRequested = true;
+    }
+    m_condition.notify_one();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void SimulationWorker::setFrameBudget(double _budget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frameBudget = _budget;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//worker loop: waits for a command, runs a frame when playing or requested, and publishes its snapshot
+void SimulationWorker::run()
+{
+    bool velocityField;
+    bool activeCells;
+    bool playing;
+    bool advance;
+    bool refresh;
+    double budget;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock,[this]{return m_quit || m_playing || m_framesRequested>0 || m_refreshRequested ||
+                                                m_pressureSolverModeChanged;});
+            if(m_quit)
+                return;
+
+            playing = m_playing;
+            advance = m_playing || m_framesRequested>0;
+            if(!m_playing && m_framesRequested>0)
+                --m_framesRequested;
+            refresh = m_refreshRequested;
+            m_refreshRequested = false;
+
+            if(m_pressureSolverModeChanged)
+            {
+                m_simulator->setPressureSolverMode(m_pressureSolverMode);
+                m_pressureSolverModeChanged = false;
+            }
+
+            velocityField = m_snapshotVelocityField;
+            activeCells = m_snapshotActiveCells;
+            budget = m_frameBudget;
+        }
+
+        FrameBudgetReport report;
+        if(advance)
+        {
+            report = m_simulator->advanceFrame(budget > 0.0 ? budget : std::numeric_limits<double>::infinity(),playing);
+            ++m_frame;
+        }
+
+        //while playing, a frame out of time does not pay for new visualisation data and the View keeps drawing the last
+        //snapshot until the next frame. A requested frame or refresh is always published
+        if(report.m_skipVisualisation && !refresh)
+            continue;
+
+        //a change of pressure solver mode alone has nothing new to show
+        if(!advance && !refresh)
+            continue;
+
+        prepareSnapshot(velocityField,activeCells,report);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void SimulationWorker::prepareSnapshot(bool _velocityField, bool _activeCells, const FrameBudgetReport& _report)
+{
+    //30Hz frames, as advanceFrame
+    float time = m_frame/30.0f;
+
+    FrameSnapshot& snapshot = m_snapshots.back();
+    snapshot.m_frame = m_frame;
+    snapshot.m_report = _report;
+    snapshot.m_particles = m_simulator->particles();
+
+    if(_velocityField)
+        snapshot.m_velocityField = m_simulator->velocityField(time);
+    else
+        snapshot.m_velocityField.clear();
+
+    if(_activeCells)
+        snapshot.m_activeCells = m_simulator->activeCells(time);
+    else
+        snapshot.m_activeCells.clear();
+
+    m_snapshots.publish();
+}
@@ -0,0 +1,98 @@
+#include "substepscheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file substepscheduler.cpp
+/// @brief implementation files for SubstepScheduler class
+//----------------------------------------------------------------------------------------------------------------------
+SubstepScheduler::SubstepScheduler() : m_history(256)
+{}
+
+//----------------------------------------------------------------------------------------------------------------------
+void SubstepScheduler::beginFrame(float _frameTime)
+{
+    m_timeLeft = _frameTime;
+
+    m_record = SubstepFrameRecord();
+    m_record.m_frame = m_frame++;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//length of the next substep, given the fastest grid velocity and the cell size
+float SubstepScheduler::nextStep(float _maxVelocity, float _cellSize)
+{
+    //CFL step, the whole frame when nothing moves
+    float step = m_timeLeft;
+    if(_maxVelocity > 0.0f)
+    {
+        step = std::min(step,m_cfl*_cellSize/_maxVelocity);
+    }
+
+    //smooth growth, the step can only shrink at once
+    if(m_lastStep > 0.0f)
+    {
+        step = std::min(step,m_maxGrowth*m_lastStep);
+    }
+
+    //a step within 1% of the time left, off only by rounding, ends the frame. A longer step than half the time left
+    //splits the end of the frame evenly instead of leaving a tiny last substep
+    if(step >= 0.99f*m_timeLeft)
+    {
+        step = m_timeLeft;
+    }
+    else if(step > 0.5f*m_timeLeft)
+    {
+        step = 0.5f*m_timeLeft;
+    }
+
+    //the substeps left must cover the time left, a shortfall within rounding does not count as limited
+    size_t substepsLeft = m_maxSubsteps > m_record.m_substeps ? m_maxSubsteps-m_record.m_substeps : 1;
+    float budgetStep = m_timeLeft/substepsLeft;
+    if(step < budgetStep)
+    {
+        m_record.m_budgetLimited = m_record.m_budgetLimited || step < 0.99f*budgetStep;
+        step = budgetStep;
+    }
+
+    //the last substep ends exactly at the frame
+    if(step >= m_timeLeft || substepsLeft == 1)
+    {
+        step = m_timeLeft;
+        m_timeLeft = 0.0f;
+    }
+    else
+    {
+        m_timeLeft -= step;
+    }
+    m_lastStep = step;
+
+    m_record.m_minTimeStep = m_record.m_substeps==0 ? step : std::min(m_record.m_minTimeStep,step);
+    m_record.m_maxTimeStep = std::max(m_record.m_maxTimeStep,step);
+    m_record.m_maxVelocity = std::max(m_record.m_maxVelocity,_maxVelocity);
+    m_record.m_maxCFL = std::max(m_record.m_maxCFL,step*_maxVelocity/_cellSize);
+    ++m_record.m_substeps;
+
+    return step;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+size_t SubstepScheduler::substepsLeft(float _maxVelocity, float _cellSize) const
+{
+    if(frameDone())
+        return 0;
+
+    size_t budget = m_maxSubsteps > m_record.m_substeps ? m_maxSubsteps-m_record.m_substeps : 1;
+    if(_maxVelocity <= 0.0f)
+        return 1;
+
+    float substeps = std::ceil(m_timeLeft*_maxVelocity/(m_cfl*_cellSize));
+    return std::min(budget,std::max<size_t>(1,static_cast<size_t>(substeps)));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void SubstepScheduler::endFrame()
+{
+    m_history.push(m_record);
+}
@@ -11,10 +11,10 @@
 /// @file View.cpp
 /// @brief implementation files for View class
 //----------------------------------------------------------------------------------------------------------------------
-View::View(QWidget *_parent, FluidSimulator *_fluidSimulator)
+View::View(QWidget *_parent, SimulationWorker *_simulationWorker)
 {
     this->resize(_parent->size());
-    setFluidSimulator(_fluidSimulator);
+    setSimulationWorker(_simulationWorker);
 
     this->m_displayGrid = true;
     this->m_displayVelocityField = false;
@@ -27,9 +27,9 @@ View::View(QWidget *_parent, FluidSimulator *_fluidSimulator)
 View::~View(){}
 
 //----------------------------------------------------------------------------------------------------------------------
-void View::setFluidSimulator(FluidSimulator* _fluidSimulator)
+void View::setSimulationWorker(SimulationWorker* _simulationWorker)
 {
-    this->m_fluidSimulator = _fluidSimulator;
+    this->m_simulationWorker = _simulationWorker;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -50,11 +50,11 @@ void View::initializeGL()
     glPolygonMode(GL_FRONT_AND_BACK,GL_LINE);
 
     //setup VAOs
-    initGridShape(m_fluidSimulator->width(),m_fluidSimulator->height(),
-             m_fluidSimulator->nColumns(),m_fluidSimulator->nRows());
+    initGridShape(m_simulationWorker->width(),m_simulationWorker->height(),
+             m_simulationWorker->nColumns(),m_simulationWorker->nRows());
     initParticleShape();
     initCellShape();
-    initVelocityField(m_fluidSimulator->cellCentres());
+    initVelocityField(m_simulationWorker->cellCentres());
 
     //setup camera
     vec3 from(m_gridWidth/2.0f,m_gridHeight/2.0f,6.0f);
@@ -69,7 +69,8 @@ void View::initializeGL()
     shader->use("nglColourShader");
     shader->setUniform("Colour",1.0f,1.0f,1.0f,1.0f);
 
-    startTimer(20);
+    //60 fps
+    startTimer(16);
     update();
 }
 
@@ -84,24 +85,28 @@ void View::paintGL()
         grid();
     }
 
+    //newest frame published by the simulation thread, the last one is drawn again until a new one is ready
+    m_simulationWorker->acquireSnapshot();
+    const FrameSnapshot& snapshot = m_simulationWorker->snapshot();
+
     if(m_displayVelocityField)
     {
-        velocityField(m_fluidSimulator->velocityField(m_time));
+        velocityField(snapshot.m_velocityField);
     }
 
     if(m_displayParticles)
     {
-        particles(m_fluidSimulator->particles());
+        particles(snapshot.m_particles);
     }
 
     if(m_displayActiveCells)
     {
-        activeCells(m_fluidSimulator->activeCells(m_time));
+        activeCells(snapshot.m_activeCells);
     }
 
     if(m_displayBoundaries)
     {
-        boundaries(m_fluidSimulator->boundaries());
+        boundaries(m_simulationWorker->boundaries());
     }
 }
 
@@ -109,15 +114,7 @@ void View::paintGL()
 //----------------------------------------------------------------------------------------------------------------------
 void View::timerEvent(QTimerEvent *)
 {
-    static float time;
-    time+=0.1f;
-    m_time = time;
-
-    if(m_playSimulation||m_playNextFrame)
-    {
-        m_fluidSimulator->advanceFrame();
-        m_playNextFrame = false;
-    }
+    //the simulation runs on its own thread, the timer only redraws
     update();
 }
 
@@ -315,16 +312,3 @@ void View::resetMVP()
     m_transform.setPosition(vec3(0.0f,0.0f,0.0f));
     m_transform.setRotation(vec3(0.0f,0.0f,0.0f));
 }
-
-//----------------------------------------------------------------------------------------------------------------------
-void View::togglePlaySimulation()
-{
-    m_playSimulation= !m_playSimulation;
-}
-
-//----------------------------------------------------------------------------------------------------------------------
-void View::togglePlayNextFrame()
-{
-    m_playSimulation = false;
-    m_playNextFrame = true;
-}